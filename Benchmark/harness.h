@@ -0,0 +1,329 @@
+#ifndef harness_h
+#define harness_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Minimal Google-Benchmark-style harness. A benchmark is a function taking
+// a bench_state and running its measured code in while (state.keep_running());
+// the harness grows the iteration count until a run lasts long enough, then
+// reports time, heap allocations, heap bytes and hardware counters per
+// iteration. Reports are free-form functions run after the microbenchmarks.
+
+// Every allocation in the process goes through the counting operator new
+// defined in the benchmark's main.cpp.
+inline std::atomic<std::size_t> allocations { 0 };
+inline std::atomic<std::size_t> allocated_bytes { 0 };
+
+template <typename T>
+inline void do_not_optimize(T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+template <typename F>
+double time_ms(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// User-space hardware counters of the calling thread, opened as one
+// perf_event_open group so they start and stop together. Any counter the
+// kernel refuses (no PMU in a VM or container, perf_event_paranoid too
+// high, not Linux) is left unavailable and reported as missing.
+class perf_counters {
+public:
+    enum event { cycles, instructions, l1d_misses, llc_misses, branch_misses, events };
+
+    static constexpr const char* names[events] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+    };
+
+    perf_counters() {
+        std::fill(fds_, fds_ + events, -1);
+#if defined(__linux__)
+        constexpr std::uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D |
+            PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        const std::pair<std::uint32_t, std::uint64_t> configs[events] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, l1d_read_miss },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        };
+        for (int e = 0; e < events; ++e) {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = configs[e].first;
+            attr.config = configs[e].second;
+            attr.disabled = leader_ < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if (fd < 0) continue;
+            if (leader_ < 0) leader_ = fd;
+            fds_[e] = fd;
+            order_[opened_++] = e;
+        }
+#endif
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    ~perf_counters() {
+#if defined(__linux__)
+        for (int fd : fds_) if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool available(int e) const { return fds_[e] >= 0; }
+    bool any() const { return leader_ >= 0; }
+
+#if defined(__linux__)
+    void reset() { control(PERF_EVENT_IOC_RESET); }
+    void start() { control(PERF_EVENT_IOC_ENABLE); }
+    void stop() { control(PERF_EVENT_IOC_DISABLE); }
+#else
+    void reset() {}
+    void start() {}
+    void stop() {}
+#endif
+
+    // Counts since the last reset, scaled up if the kernel had to multiplex
+    // the group with other users of the PMU. Unavailable counters read 0.
+    void read(double (&out)[events]) const {
+        std::fill(out, out + events, 0.0);
+#if defined(__linux__)
+        if (leader_ < 0) return;
+        std::uint64_t buffer[3 + events] {};   // nr, time enabled, time running, values
+        if (::read(leader_, buffer, sizeof(buffer)) <= 0 || buffer[2] == 0) return;
+        double scale = double(buffer[1]) / double(buffer[2]);
+        for (int i = 0; i < opened_; ++i) out[order_[i]] = double(buffer[3 + i]) * scale;
+#endif
+    }
+
+private:
+    int fds_[events];
+    int order_[events] {};     // event of each group member, in opening order
+    int opened_ = 0;
+    int leader_ = -1;
+
+#if defined(__linux__)
+    void control(unsigned long request) {
+        if (leader_ >= 0) ioctl(leader_, request, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+};
+
+class bench_state {
+    using clock = std::chrono::steady_clock;
+
+public:
+    bench_state(std::size_t iterations, perf_counters& counters) :
+    iterations_(iterations),
+    left_(iterations),
+    elapsed_(0),
+    allocs_(0),
+    bytes_(0),
+    running_(false),
+    counters_(counters) {
+        counters_.reset();
+    }
+
+    // Loop condition for the measured code: while (state.keep_running()).
+    bool keep_running() {
+        if (left_ == iterations_) start();
+        if (left_) {
+            --left_;
+            return true;
+        }
+        stop();
+        return false;
+    }
+
+    // Excludes setup and teardown inside the loop from time, allocation and
+    // counter totals. Meant to be called once per batch, not per iteration.
+    void pause_timing() { stop(); }
+    void resume_timing() { start(); }
+
+    std::size_t iterations() const { return iterations_; }
+    double elapsed_ns() const { return std::chrono::duration<double, std::nano>(elapsed_).count(); }
+    std::size_t allocs() const { return allocs_; }
+    std::size_t bytes() const { return bytes_; }
+
+private:
+    std::size_t iterations_;
+    std::size_t left_;
+    clock::duration elapsed_;
+    std::size_t allocs_;
+    std::size_t bytes_;
+    bool running_;
+    perf_counters& counters_;
+    clock::time_point started_;
+    std::size_t allocs_at_start_ = 0;
+    std::size_t bytes_at_start_ = 0;
+
+    void start() {
+        if (running_) return;
+        running_ = true;
+        allocs_at_start_ = allocations.load(std::memory_order_relaxed);
+        bytes_at_start_ = allocated_bytes.load(std::memory_order_relaxed);
+        counters_.start();
+        started_ = clock::now();
+    }
+
+    void stop() {
+        if (!running_) return;
+        elapsed_ += clock::now() - started_;
+        counters_.stop();
+        allocs_ += allocations.load(std::memory_order_relaxed) - allocs_at_start_;
+        bytes_ += allocated_bytes.load(std::memory_order_relaxed) - bytes_at_start_;
+        running_ = false;
+    }
+};
+
+class benchmarks {
+public:
+    using function = void (*)(bench_state&);
+    using report = void (*)();
+
+    // csv and json print only the microbenchmarks, one record each, so the
+    // output can be diffed or loaded as is.
+    enum class format { console, csv, json };
+
+    static void add(std::string name, function f) {
+        registry().micro.push_back({ std::move(name), f });
+    }
+
+    static void add_report(std::string name, report f) {
+        registry().reports.push_back({ std::move(name), f });
+    }
+
+    // Runs every benchmark and report whose name contains filter.
+    static void run(const char* filter, format out = format::console) {
+        perf_counters counters;
+        print_header(out, counters);
+        bool first = true;
+        for (auto& [name, f] : registry().micro) {
+            if (!matches(name, filter)) continue;
+            print_result(out, counters, name, measure(f, counters), first);
+            first = false;
+        }
+        if (out == format::json) std::printf("\n]\n");
+        if (out != format::console) return;
+        for (auto& [name, f] : registry().reports) {
+            if (!matches(name, filter)) continue;
+            std::printf("\n%s\n", name.c_str());
+            f();
+        }
+    }
+
+private:
+    static constexpr double min_time_ns = 200e6;
+
+    struct lists {
+        std::vector<std::pair<std::string, function>> micro;
+        std::vector<std::pair<std::string, report>> reports;
+    };
+
+    // Per-iteration figures of the final run.
+    struct result {
+        std::size_t iterations;
+        double ns;
+        double allocs;
+        double bytes;
+        double counters[perf_counters::events];
+    };
+
+    static lists& registry() {
+        static lists l;
+        return l;
+    }
+
+    static bool matches(const std::string& name, const char* filter) {
+        return !filter || name.find(filter) != std::string::npos;
+    }
+
+    // Grows the iteration count, at most tenfold per step, until one run
+    // takes at least min_time_ns.
+    static result measure(function f, perf_counters& counters) {
+        std::size_t n = 1;
+        for (;;) {
+            bench_state state(n, counters);
+            f(state);
+            double ns = state.elapsed_ns();
+            if (ns >= min_time_ns || n >= std::size_t(1) << 40) {
+                result r { n, ns / n, double(state.allocs()) / n, double(state.bytes()) / n, {} };
+                counters.read(r.counters);
+                for (double& c : r.counters) c /= n;
+                return r;
+            }
+            double next = ns > 0 ? n * min_time_ns * 1.4 / ns : n * 10.0;
+            n = std::max(n + 1, std::min(std::size_t(next), n * 10));
+        }
+    }
+
+    static void print_header(format out, const perf_counters& counters) {
+        if (out == format::json) {
+            std::printf("[");
+        } else if (out == format::csv) {
+            std::printf("name,iterations,ns_per_op,allocs_per_op,bytes_per_op");
+            for (const char* c : perf_counters::names) std::printf(",%s_per_op", c);
+            std::printf("\n");
+        } else {
+            std::printf("%-44s %12s %12s %10s %10s", "Benchmark", "Time", "Iterations", "allocs/op", "bytes/op");
+            if (counters.any())
+                std::printf(" %9s %9s %9s %9s %9s", "cycles", "instr", "L1d-miss", "LLC-miss", "br-miss");
+            std::printf("\n%s\n", std::string(counters.any() ? 142 : 92, '-').c_str());
+            if (!counters.any()) std::printf("(hardware counters unavailable)\n");
+        }
+    }
+
+    // Missing counters print as "-" on the console, an empty CSV field and
+    // null in JSON.
+    static void print_result(format out, const perf_counters& counters, const std::string& name,
+                             const result& r, bool first) {
+        if (out == format::console) {
+            std::printf("%-44s %9.2f ns %12zu %10.2f %10.1f", name.c_str(), r.ns, r.iterations, r.allocs, r.bytes);
+            for (int e = 0; e < perf_counters::events && counters.any(); ++e) {
+                if (counters.available(e)) std::printf(" %9.2f", r.counters[e]);
+                else std::printf(" %9s", "-");
+            }
+            std::printf("\n");
+        } else if (out == format::csv) {
+            std::printf("\"%s\",%zu,%.3f,%.3f,%.3f", name.c_str(), r.iterations, r.ns, r.allocs, r.bytes);
+            for (int e = 0; e < perf_counters::events; ++e) {
+                if (counters.available(e)) std::printf(",%.3f", r.counters[e]);
+                else std::printf(",");
+            }
+            std::printf("\n");
+        } else {
+            std::printf("%s\n  {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.3f, "
+                        "\"allocs_per_op\": %.3f, \"bytes_per_op\": %.3f",
+                        first ? "" : ",", name.c_str(), r.iterations, r.ns, r.allocs, r.bytes);
+            for (int e = 0; e < perf_counters::events; ++e) {
+                if (counters.available(e)) std::printf(", \"%s_per_op\": %.3f", perf_counters::names[e], r.counters[e]);
+                else std::printf(", \"%s_per_op\": null", perf_counters::names[e]);
+            }
+            std::printf("}");
+        }
+    }
+};
+
+#endif /* harness_h */
@@ -0,0 +1,965 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "harness.h"
+#include "smart_ptr.h"
+#include "atomic_smart_ptr.h"
+#include "cow_ptr.h"
+#include "intrusive_smart_ptr.h"
+#include "reclaim_domain.h"
+#include "mapped_file.h"
+#include "side_table.h"
+#include "smart_ref.h"
+#include "smart_vector.h"
+
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Counts every allocation in the process for the harness. Blocks served by
+// block_pool show up only when a new slab is carved. Kept out of line so GCC
+// does not pair the inlined malloc() and free() with new and delete.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t align) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = nullptr;
+    if (posix_memalign(&p, std::max(std::size_t(align), sizeof(void*)), size ? size : 1) == 0) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+struct Point { int x = 2; int y = -5; };
+
+constexpr int iterations = 1'000'000;
+
+// How each pointer type makes a fresh object and a deep copy of one.
+template <typename Ptr>
+struct pointer_ops;
+
+template <typename Count>
+struct pointer_ops<smart_ptr<Point, Count>> {
+    static smart_ptr<Point, Count> make() { return make_smart<Point, Count>(); }
+    static smart_ptr<Point, Count> deep_copy(const smart_ptr<Point, Count>& p) {
+        smart_ptr<Point, Count> copy = p;
+        copy.clone();
+        return copy;
+    }
+    static smart_ptr<int, Count> alias(const smart_ptr<Point, Count>& p) { return smart_ptr<int, Count>(p, &p->x); }
+};
+
+template <>
+struct pointer_ops<std::shared_ptr<Point>> {
+    static std::shared_ptr<Point> make() { return std::make_shared<Point>(); }
+    static std::shared_ptr<Point> deep_copy(const std::shared_ptr<Point>& p) { return std::make_shared<Point>(*p); }
+    static std::shared_ptr<int> alias(const std::shared_ptr<Point>& p) { return std::shared_ptr<int>(p, &p->x); }
+};
+
+template <>
+struct pointer_ops<std::unique_ptr<Point>> {
+    static std::unique_ptr<Point> make() { return std::make_unique<Point>(); }
+    static std::unique_ptr<Point> deep_copy(const std::unique_ptr<Point>& p) { return std::make_unique<Point>(*p); }
+};
+
+// Uninitialized room for a batch of pointers, so constructing one is timed
+// without the bookkeeping of a container.
+template <typename Ptr>
+class batch {
+public:
+    static constexpr std::size_t capacity = 1024;
+
+    batch() :
+    data_(static_cast<Ptr*>(::operator new(capacity * sizeof(Ptr)))),
+    size_(0) {}
+
+    batch(const batch&) = delete;
+    batch& operator=(const batch&) = delete;
+
+    ~batch() {
+        clear();
+        ::operator delete(data_);
+    }
+
+    Ptr& operator[](std::size_t i) { return data_[i]; }
+
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        std::construct_at(data_ + size_++, std::forward<Args>(args)...);
+    }
+
+    void pop() { std::destroy_at(data_ + --size_); }
+
+    void clear() {
+        std::destroy(data_, data_ + size_);
+        size_ = 0;
+    }
+
+    // Refills the batch with sole owners of fresh objects.
+    void fill() {
+        clear();
+        while (size_ < capacity) emplace(pointer_ops<Ptr>::make());
+    }
+
+private:
+    Ptr* data_;
+    std::size_t size_;
+};
+
+// Runs op(i) once per iteration, with i counting through a batch, and calls
+// refill() untimed before every batch.
+template <typename Refill, typename Op>
+void batched(bench_state& state, Refill refill, Op op) {
+    std::size_t i = batch<int*>::capacity;
+    while (state.keep_running()) {
+        if (i == batch<int*>::capacity) {
+            state.pause_timing();
+            refill();
+            state.resume_timing();
+            i = 0;
+        }
+        op(i++);
+    }
+}
+
+template <typename Ptr>
+struct construct_raw {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        batch<Ptr> out;
+        batched(state, [&] { out.clear(); }, [&](std::size_t) { out.emplace(new Point); });
+    }
+};
+
+template <typename Ptr>
+struct make {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        batch<Ptr> out;
+        batched(state, [&] { out.clear(); }, [&](std::size_t) { out.emplace(pointer_ops<Ptr>::make()); });
+    }
+};
+
+template <typename Ptr>
+struct copy_construct {
+    static constexpr bool copies = true;
+
+    static void run(bench_state& state) {
+        Ptr source = pointer_ops<Ptr>::make();
+        batch<Ptr> out;
+        batched(state, [&] { out.clear(); }, [&](std::size_t) { out.emplace(source); });
+    }
+};
+
+template <typename Ptr>
+struct move_construct {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        batch<Ptr> in, out;
+        batched(state, [&] { out.clear(); in.fill(); },
+                [&](std::size_t i) { out.emplace(std::move(in[i])); });
+    }
+};
+
+// Assigns into empty pointers, so nothing is released on the way.
+template <typename Ptr>
+struct copy_assign {
+    static constexpr bool copies = true;
+
+    static void run(bench_state& state) {
+        Ptr source = pointer_ops<Ptr>::make();
+        batch<Ptr> out;
+        auto refill = [&] {
+            out.clear();
+            for (std::size_t i = 0; i < batch<Ptr>::capacity; ++i) out.emplace();
+        };
+        batched(state, refill, [&](std::size_t i) { out[i] = source; });
+    }
+};
+
+template <typename Ptr>
+struct move_assign {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        batch<Ptr> in, out;
+        auto refill = [&] {
+            out.clear();
+            for (std::size_t i = 0; i < batch<Ptr>::capacity; ++i) out.emplace();
+            in.fill();
+        };
+        batched(state, refill, [&](std::size_t i) { out[i] = std::move(in[i]); });
+    }
+};
+
+// smart_ptr::clone() on a shared object; the baselines copy the pointee
+// into a new owner, which is what clone() amounts to.
+template <typename Ptr>
+struct clone_object {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        Ptr source = pointer_ops<Ptr>::make();
+        batch<Ptr> out;
+        batched(state, [&] { out.clear(); },
+                [&](std::size_t) { out.emplace(pointer_ops<Ptr>::deep_copy(source)); });
+    }
+};
+
+// A pointer to one member that keeps the whole object alive.
+template <typename Ptr>
+struct alias_member {
+    static constexpr bool copies = true;
+
+    static void run(bench_state& state) {
+        Ptr source = pointer_ops<Ptr>::make();
+        batch<decltype(pointer_ops<Ptr>::alias(source))> out;
+        batched(state, [&] { out.clear(); }, [&](std::size_t) { out.emplace(pointer_ops<Ptr>::alias(source)); });
+    }
+};
+
+// One operator* and one operator-> per iteration; the pointer is reloaded
+// every time so the null checks cannot be hoisted.
+template <typename Ptr>
+struct dereference {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        Ptr p = pointer_ops<Ptr>::make();
+        int sum = 0;
+        while (state.keep_running()) {
+            do_not_optimize(p);
+            sum += (*p).x + p->y;
+        }
+        do_not_optimize(sum);
+    }
+};
+
+// Sums a field through every pointer in a batch, which is where the null
+// check in operator-> costs the most.
+template <typename Check>
+void deref_loop(bench_state& state) {
+    std::vector<smart_ptr<Point, single_threaded, Check>> points;
+    for (int i = 0; i < 256; ++i) points.push_back(make_smart<Point>());
+    long long sum = 0;
+    while (state.keep_running()) {
+        do_not_optimize(points);
+        for (const auto& p : points) sum += p->x;
+    }
+    do_not_optimize(sum);
+}
+
+void deref_loop_try_get(bench_state& state) {
+    std::vector<smart_ptr<Point>> points;
+    for (int i = 0; i < 256; ++i) points.push_back(make_smart<Point>());
+    long long sum = 0;
+    while (state.keep_running()) {
+        do_not_optimize(points);
+        for (const auto& p : points)
+            if (Point* q = p.try_get()) sum += q->x;
+    }
+    do_not_optimize(sum);
+}
+
+// Hands a shared pointer to an out-of-line helper that reads one field.
+[[gnu::noinline]] int read_by_value(smart_ptr<Point, multi_threaded> p) {
+    return p->x;
+}
+
+[[gnu::noinline]] int read_by_ref(smart_ref<Point, multi_threaded> p) {
+    return p->x;
+}
+
+template <auto Read>
+void pass_to_helper(bench_state& state) {
+    auto p = make_smart<Point, multi_threaded>();
+    long long sum = 0;
+    while (state.keep_running()) sum += Read(p);
+    do_not_optimize(sum);
+}
+
+// Builds and drops a buffer of 4096 floats.
+template <std::size_t Align>
+void make_array(bench_state& state) {
+    while (state.keep_running()) {
+        auto buffer = make_smart<float[]>(4096, Align);
+        do_not_optimize(buffer);
+    }
+}
+
+template <std::size_t Align>
+void make_array_for_overwrite(bench_state& state) {
+    while (state.keep_running()) {
+        auto buffer = make_smart_for_overwrite<float[]>(4096, Align);
+        do_not_optimize(buffer);
+    }
+}
+
+#if defined(__cpp_lib_smart_ptr_for_overwrite)
+void make_shared_array(bench_state& state) {
+    while (state.keep_running()) {
+        auto buffer = std::make_shared<float[]>(4096);
+        do_not_optimize(buffer);
+    }
+}
+
+void make_shared_array_for_overwrite(bench_state& state) {
+    while (state.keep_running()) {
+        auto buffer = std::make_shared_for_overwrite<float[]>(4096);
+        do_not_optimize(buffer);
+    }
+}
+#endif
+
+// Drops the last owner, freeing the object and its control block.
+template <typename Ptr>
+struct destroy {
+    static constexpr bool copies = false;
+
+    static void run(bench_state& state) {
+        batch<Ptr> in;
+        batched(state, [&] { in.fill(); }, [&](std::size_t) { in.pop(); });
+    }
+};
+
+template <template <typename> class Bench, typename Ptr>
+void add_for(const char* op, const char* type) {
+    if constexpr (!Bench<Ptr>::copies || std::is_copy_constructible_v<Ptr>)
+        benchmarks::add(std::string(op) + "/" + type, Bench<Ptr>::run);
+}
+
+template <template <typename> class Bench>
+void add_pointer_benchmarks(const char* op) {
+    add_for<Bench, smart_ptr<Point>>(op, "smart_ptr");
+    add_for<Bench, smart_ptr<Point, multi_threaded>>(op, "smart_ptr<multi_threaded>");
+    add_for<Bench, smart_ptr<Point, unique_first>>(op, "smart_ptr<unique_first>");
+    add_for<Bench, std::shared_ptr<Point>>(op, "std::shared_ptr");
+    add_for<Bench, std::unique_ptr<Point>>(op, "std::unique_ptr");
+}
+
+// Every thread copies and drops its own handle to one shared object, so all
+// count updates land on the same control block, unless it is immortal.
+template <typename Count>
+void bench_copy_destroy(const char* name, unsigned threads, bool immortal = false) {
+    auto shared = immortal ? make_immortal<Point, Count>() : make_smart<Point, Count>();
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([local = shared] {
+            for (int i = 0; i < iterations; ++i) {
+                smart_ptr<Point, Count> copy { local };
+                do_not_optimize(copy);
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::printf("%-16s %2u threads %8.2f Mops/s\n",
+                name, threads, threads * double(iterations) / seconds / 1e6);
+}
+
+// Each thread mostly copies an object it created itself and, one copy in
+// twenty, a handle to an object created by the main thread.
+template <typename Count>
+void bench_owner_local(const char* name, unsigned threads) {
+    auto shared = make_smart<Point, Count>();
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([remote = shared] {
+            auto own = make_smart<Point, Count>();
+            for (int i = 0; i < iterations; ++i) {
+                smart_ptr<Point, Count> copy { i % 20 ? own : remote };
+                do_not_optimize(copy);
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::printf("%-16s %2u threads %8.2f Mops/s\n",
+                name, threads, threads * double(iterations) / seconds / 1e6);
+}
+
+static_assert(std::is_nothrow_default_constructible_v<smart_ptr<Point>>);
+static_assert(std::is_nothrow_copy_constructible_v<smart_ptr<Point>>);
+static_assert(std::is_nothrow_move_constructible_v<smart_ptr<Point>>);
+
+// Empty and moved-from pointers must not own heap memory, so a vector of
+// empty slots costs exactly one allocation: its own buffer.
+bool check_empty_slots() {
+    std::size_t before = allocations.load(std::memory_order_relaxed);
+    std::vector<smart_ptr<Point>> slots(iterations);
+    std::size_t count = allocations.load(std::memory_order_relaxed) - before;
+
+    auto sp = make_smart<Point>();
+    auto moved = std::move(sp);
+    bool ok = count == 1 && sp.ref_count() == 0 && slots[0].ref_count() == 0;
+    std::fprintf(stderr, "%d empty slots: %zu allocation(s), moved-from count %d: %s\n",
+                 iterations, count, sp.ref_count(), ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Singly linked lists that own their tail. Link opts into iterative
+// teardown; RecursiveLink frees its chain the default way.
+struct Link;
+
+template <>
+inline constexpr bool iterative_teardown<Link> = true;
+
+struct Link {
+    static inline std::size_t destroyed = 0;
+    smart_ptr<Link> next;
+    ~Link() { ++destroyed; }
+};
+
+struct RecursiveLink {
+    smart_ptr<RecursiveLink> next;
+};
+
+template <typename L>
+smart_ptr<L> make_chain(std::size_t length) {
+    smart_ptr<L> head;
+    for (std::size_t i = 0; i < length; ++i) {
+        auto node = make_smart<L>();
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    return head;
+}
+
+// Dropping the head of a 10M-node chain must free every node without
+// running out of stack.
+bool check_chain_teardown() {
+    constexpr std::size_t length = 10'000'000;
+    auto head = make_chain<Link>(length);
+    Link::destroyed = 0;
+    double ms = time_ms([&] { head = smart_ptr<Link>(); });
+    bool ok = Link::destroyed == length;
+    std::fprintf(stderr, "%zu-node chain: %zu destroyed in %.1f ms: %s\n",
+                 length, Link::destroyed, ms, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Teardown latency of a whole chain. The recursive version stops at lengths
+// that fit on a default 8 MB stack.
+void report_chain_teardown() {
+    for (std::size_t length : { 1'000u, 100'000u }) {
+        auto head = make_chain<RecursiveLink>(length);
+        double ms = time_ms([&] { head = smart_ptr<RecursiveLink>(); });
+        std::printf("recursive %10zu nodes %10.3f ms %6.2f ns/node\n", length, ms, ms * 1e6 / length);
+    }
+    for (std::size_t length : { 1'000u, 100'000u, 10'000'000u }) {
+        auto head = make_chain<Link>(length);
+        double ms = time_ms([&] { head = smart_ptr<Link>(); });
+        std::printf("iterative %10zu nodes %10.3f ms %6.2f ns/node\n", length, ms, ms * 1e6 / length);
+    }
+}
+
+// A request thread drops the last reference to a large object, a map of
+// 20,000 nodes, once per request. Only the release is timed.
+template <typename Make>
+void bench_release_latency(const char* name, Make make) {
+    constexpr int requests = 500;
+    std::vector<double> us;
+    for (int i = 0; i < requests; ++i) {
+        auto object = make();
+        auto start = std::chrono::steady_clock::now();
+        object = decltype(object)();
+        us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    background_reclaimer::flush();
+    std::sort(us.begin(), us.end());
+    std::printf("%-16s p50 %8.2f us  p99 %8.2f us  max %8.2f us\n",
+                name, us[requests / 2], us[requests * 99 / 100], us.back());
+}
+
+void report_release_latency() {
+    using table = std::map<int, int>;
+    auto fill = [] {
+        auto* t = new table;
+        for (int i = 0; i < 20'000; ++i) t->emplace(i, i);
+        return t;
+    };
+    bench_release_latency("inline", [&] { return smart_ptr<table>(fill()); });
+    bench_release_latency("deferred", [&] { return smart_ptr<table>(fill(), deferred_delete<table>()); });
+}
+
+// Binary tree whose nodes go to a reclaim_domain when released, so each
+// destroyed node retires its two children instead of destroying them.
+struct TreeNode {
+    smart_ptr<TreeNode> left, right;
+};
+
+smart_ptr<TreeNode> make_tree(int depth, reclaim_domain& domain) {
+    if (!depth) return smart_ptr<TreeNode>();
+    smart_ptr<TreeNode> node { new TreeNode, deferred_delete<TreeNode>(domain) };
+    node->left = make_tree(depth - 1, domain);
+    node->right = make_tree(depth - 1, domain);
+    return node;
+}
+
+// Tears down a 1M-node tree in one reclaim() call, then tick by tick under
+// an object budget and under a time budget.
+void report_budgeted_reclaim() {
+    {
+        reclaim_domain domain;
+        make_tree(20, domain);
+        double stall_ms = time_ms([&] { domain.reclaim(); });
+        std::printf("%-22s %6d ticks, worst %8.3f ms\n", "unbudgeted", 1, stall_ms);
+    }
+    auto ticks = [](const char* name, reclaim_domain::budget limit) {
+        reclaim_domain domain;
+        make_tree(20, domain);
+        int n = 0;
+        double worst_ms = 0;
+        std::size_t peak = 0;
+        for (auto stats = domain.stats(); stats.queued; stats = domain.stats()) {
+            peak = std::max(peak, stats.queued);
+            worst_ms = std::max(worst_ms, time_ms([&] { domain.reclaim(limit); }));
+            ++n;
+        }
+        auto stats = domain.stats();
+        std::printf("%-22s %6d ticks, worst %8.3f ms, peak queue %7zu, oldest waited %8.2f ms\n",
+                    name, n, worst_ms, peak, std::chrono::duration<double, std::milli>(stats.max_age).count());
+    };
+    ticks("10000 objects per tick", { 10'000, std::chrono::nanoseconds::max() });
+    ticks("1 ms per tick", { SIZE_MAX, std::chrono::milliseconds(1) });
+}
+
+struct Node : ref_counted<Node> {
+    int key;
+    explicit Node(int k) : key(k) {}
+};
+
+// Copies, sorts and walks a vector of pointers to the same shuffled nodes.
+template <typename Ptr>
+void bench_container(const char* name, const std::vector<Ptr>& nodes) {
+    std::vector<Ptr> copy;
+    double copy_ms = time_ms([&] { copy = nodes; });
+    double sort_ms = time_ms([&] {
+        std::sort(copy.begin(), copy.end(), [](const Ptr& a, const Ptr& b) { return a->key < b->key; });
+    });
+    long long sum = 0;
+    double walk_ms = time_ms([&] {
+        for (const Ptr& p : copy) sum += p->key;
+    });
+    do_not_optimize(sum);
+    std::printf("%-26s %2zu bytes %8.2f ms copy %8.2f ms sort %8.2f ms traverse\n",
+                name, sizeof(Ptr), copy_ms, sort_ms, walk_ms);
+}
+
+// Threads repeatedly build and drop batches of raw-pointer smart_ptrs, so
+// every iteration allocates and frees one control block.
+template <typename Make>
+void bench_churn(const char* name, unsigned threads, Make make) {
+    constexpr int batch = 256;
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([make] {
+            std::vector<smart_ptr<int>> live;
+            live.reserve(batch);
+            for (int i = 0; i < iterations; i += batch) {
+                for (int j = 0; j < batch; ++j) live.push_back(make(j));
+                live.clear();
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::printf("%-16s %2u threads %8.2f Mops/s\n",
+                name, threads, threads * double(iterations) / seconds / 1e6);
+}
+
+// Hands a 4 KB config to many readers, one in a hundred of which edits its
+// copy, either by copying eagerly or by sharing a cow_ptr.
+void bench_read_mostly() {
+    constexpr int readers = 100'000;
+    const std::vector<int> config(1024, 7);
+    long long sum = 0;
+
+    double eager_ms = time_ms([&] {
+        for (int i = 0; i < readers; ++i) {
+            std::vector<int> copy = config;
+            if (i % 100 == 0) copy[0] = i;
+            sum += copy[0] + copy[1023];
+        }
+    });
+
+    auto shared = make_cow<std::vector<int>>(config);
+    double cow_ms = time_ms([&] {
+        for (int i = 0; i < readers; ++i) {
+            cow_ptr<std::vector<int>> copy = shared;
+            if (i % 100 == 0) copy.mut()[0] = i;
+            sum += (*copy)[0] + (*copy)[1023];
+        }
+    });
+    do_not_optimize(sum);
+    std::printf("%d readers, 1%% writers: %8.2f ms eager copy %8.2f ms cow_ptr\n",
+                readers, eager_ms, cow_ms);
+}
+
+// Readers load and dereference the current snapshot for a fixed time while
+// one writer keeps publishing new ones.
+template <typename Load, typename Store>
+void bench_readers(const char* name, unsigned readers, Load load, Store store) {
+    std::atomic<bool> stop { false };
+    std::atomic<long long> loads { 0 };
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < readers; ++t) {
+        workers.emplace_back([&] {
+            long long n = 0, sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                sum += load();
+                ++n;
+            }
+            do_not_optimize(sum);
+            loads.fetch_add(n);
+        });
+    }
+    std::thread writer([&] {
+        for (int version = 0; !stop.load(std::memory_order_relaxed); ++version) {
+            store(version);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    stop = true;
+    for (auto& worker : workers) worker.join();
+    writer.join();
+    std::printf("%-32s %2u readers %8.2f Mloads/s\n", name, readers, loads / 0.2 / 1e6);
+}
+
+void bench_snapshots(unsigned readers) {
+    using snapshot = smart_ptr<int, multi_threaded>;
+    atomic_smart_ptr<int> slot { make_smart<int, multi_threaded>(0) };
+    bench_readers("atomic_smart_ptr", readers,
+                  [&] { return *slot.load(); },
+                  [&](int v) { slot.store(make_smart<int, multi_threaded>(v)); });
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<std::shared_ptr<int>> shared { std::make_shared<int>(0) };
+    bench_readers("std::atomic<std::shared_ptr>", readers,
+                  [&] { return *shared.load(); },
+                  [&](int v) { shared.store(std::make_shared<int>(v)); });
+#endif
+
+    std::mutex lock;
+    snapshot guarded = make_smart<int, multi_threaded>(0);
+    bench_readers("mutex + smart_ptr", readers,
+                  [&] {
+                      snapshot copy;
+                      {
+                          std::lock_guard<std::mutex> hold(lock);
+                          copy = guarded;
+                      }
+                      return *copy;
+                  },
+                  [&](int v) {
+                      snapshot next = make_smart<int, multi_threaded>(v);
+                      std::lock_guard<std::mutex> hold(lock);
+                      guarded = std::move(next);
+                  });
+}
+
+void report_copy_destroy() {
+    bench_copy_destroy<single_threaded>("single_threaded", 1);
+    for (unsigned threads : { 1u, 2u, 4u, 8u })
+        bench_copy_destroy<multi_threaded>("multi_threaded", threads);
+    for (unsigned threads : { 1u, 2u, 4u, 8u })
+        bench_copy_destroy<multi_threaded>("immortal", threads, true);
+}
+
+void report_owner_local() {
+    for (unsigned threads : { 1u, 4u, 16u }) {
+        bench_owner_local<multi_threaded>("multi_threaded", threads);
+        bench_owner_local<biased>("biased", threads);
+    }
+}
+
+void report_churn() {
+    for (unsigned threads : { 1u, 4u, 8u }) {
+        bench_churn("std::allocator", threads, [](int j) {
+            return smart_ptr<int>(new int(j), std::default_delete<int>(), std::allocator<int>());
+        });
+        bench_churn("block_pool", threads, [](int j) { return smart_ptr<int>(new int(j)); });
+    }
+    std::vector<smart_ptr<int>> handoff;
+    for (int i = 0; i < 10'000; ++i) handoff.emplace_back(new int(i));
+    std::thread([&handoff] { handoff.clear(); }).join();
+    auto stats = block_pool::stats();
+    std::printf("block_pool: %zu live, %zu cached, %zu awaiting their owner, %zu remote frees\n",
+                stats.blocks_live, stats.blocks_cached, stats.blocks_remote, stats.remote_frees);
+}
+
+void report_snapshots() {
+    for (unsigned readers : { 1u, 2u, 4u, 8u }) bench_snapshots(readers);
+}
+
+void report_containers() {
+    std::vector<int> keys(iterations);
+    for (int i = 0; i < iterations; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    {
+        std::vector<smart_ptr<Node>> nodes;
+        for (int key : keys) nodes.push_back(make_smart<Node>(key));
+        bench_container("smart_ptr<Node>", nodes);
+    }
+    {
+        std::vector<intrusive_smart_ptr<Node>> nodes;
+        for (int key : keys) nodes.emplace_back(new Node(key));
+        bench_container("intrusive_smart_ptr<Node>", nodes);
+    }
+}
+
+#if __has_include(<sys/mman.h>)
+// Startup cost of a 256 MB data file: reading it into the heap against
+// mapping it, then 1000 random lookups, which fault in only their pages.
+void report_mapped_file() {
+    constexpr std::size_t words = std::size_t(32) << 20;
+    std::string path = std::string(std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp") + "/smart_ptr_bench.bin";
+    {
+        std::vector<std::uint64_t> data(words);
+        for (std::size_t i = 0; i < words; ++i) data[i] = i;
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f || std::fwrite(data.data(), sizeof(std::uint64_t), words, f) != words) {
+            std::printf("cannot write %s\n", path.c_str());
+            if (f) std::fclose(f);
+            return;
+        }
+        std::fclose(f);
+    }
+    std::mt19937_64 rng(42);
+    std::vector<std::size_t> probes(1000);
+    for (auto& p : probes) p = rng() % words;
+    auto lookups = [&](const std::uint64_t* w) {
+        std::uint64_t sum = 0;
+        for (std::size_t p : probes) sum += w[p];
+        do_not_optimize(sum);
+    };
+
+    smart_ptr<std::uint64_t[]> heap;
+    double read_ms = time_ms([&] {
+        heap = make_smart_for_overwrite<std::uint64_t[]>(words);
+        FILE* f = std::fopen(path.c_str(), "rb");
+        std::size_t n = std::fread(heap.try_get(), sizeof(std::uint64_t), words, f);
+        std::fclose(f);
+        do_not_optimize(n);
+    });
+    double heap_lookup_ms = time_ms([&] { lookups(heap.try_get()); });
+    heap = smart_ptr<std::uint64_t[]>();
+
+    smart_ptr<const std::uint64_t[]> mapped;
+    double map_ms = time_ms([&] {
+        mapped = view_as<std::uint64_t>(map_file<>(path.c_str(), map_advice::random), 0, words);
+    });
+    double mapped_lookup_ms = time_ms([&] { lookups(mapped.try_get()); });
+    mapped = smart_ptr<const std::uint64_t[]>();
+
+    std::remove(path.c_str());
+    std::printf("%-10s open %9.3f ms, 1000 lookups %8.3f ms\n", "read()", read_ms, heap_lookup_ms);
+    std::printf("%-10s open %9.3f ms, 1000 lookups %8.3f ms\n", "map_file()", map_ms, mapped_lookup_ms);
+}
+#endif
+
+#if defined(__linux__)
+struct Record {
+    char payload[240] {};
+};
+
+// Private_Dirty of the calling process from /proc/self/smaps_rollup, in kB.
+std::size_t private_dirty_kb() {
+    FILE* f = std::fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    char line[256];
+    std::size_t total = 0, kb;
+    while (std::fgets(line, sizeof(line), f))
+        if (std::sscanf(line, "Private_Dirty: %zu kB", &kb) == 1) total += kb;
+    std::fclose(f);
+    return total;
+}
+
+// Forks workers that each copy and drop every pointer in records once, and
+// reports how much memory each of them stopped sharing with the parent.
+template <typename Ptr>
+void bench_fork_workers(const char* name, const std::vector<Ptr>& records, int workers) {
+    std::vector<std::pair<pid_t, int>> children;
+    for (int w = 0; w < workers; ++w) {
+        int fds[2];
+        if (pipe(fds) != 0) break;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            std::size_t before = private_dirty_kb();
+            for (const Ptr& record : records) {
+                Ptr copy = record;
+                do_not_optimize(copy);
+            }
+            std::size_t grown = private_dirty_kb() - before;
+            ssize_t written = write(fds[1], &grown, sizeof(grown));
+            _exit(written == sizeof(grown) ? 0 : 1);
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            break;
+        }
+        children.push_back({ pid, fds[0] });
+    }
+    std::size_t total = 0, worst = 0;
+    for (auto [pid, fd] : children) {
+        std::size_t grown = 0;
+        if (read(fd, &grown, sizeof(grown)) != sizeof(grown)) grown = 0;
+        close(fd);
+        waitpid(pid, nullptr, 0);
+        total += grown;
+        worst = std::max(worst, grown);
+    }
+    if (children.empty()) return;
+    std::printf("%-26s %2zu workers, private RSS growth avg %8.1f MB, max %8.1f MB\n", name, children.size(),
+                total / 1024.0 / children.size(), worst / 1024.0);
+}
+
+// 200,000 records of 256 bytes built before forking 4 workers.
+void report_fork_rss() {
+    constexpr std::size_t count = 200'000;
+    constexpr int workers = 4;
+    {
+        std::vector<smart_ptr<Record, multi_threaded>> records;
+        for (std::size_t i = 0; i < count; ++i) records.push_back(make_smart<Record, multi_threaded>());
+        bench_fork_workers("counts in the block", records, workers);
+    }
+    {
+        frozen_arena arena(count * 320);
+        std::vector<smart_ptr<Record, side_table>> records;
+        for (std::size_t i = 0; i < count; ++i)
+            records.push_back(allocate_smart<Record, side_table>(arena_allocator<Record>(arena)));
+        arena.freeze();
+        bench_fork_workers("side_table, frozen arena", records, workers);
+    }
+}
+#endif
+
+// Grows a vector to 10M copies of one pointer without reserving, then
+// inserts and erases 10 elements in the middle; every step relocates the
+// elements after it. Best of three runs.
+template <typename Vector>
+void bench_pointer_vector(const char* name, const typename Vector::value_type& p) {
+    constexpr std::size_t count = 10'000'000;
+    double grow_ms = 1e9, insert_ms = 1e9, erase_ms = 1e9;
+    for (int run = 0; run < 3; ++run) {
+        Vector v;
+        grow_ms = std::min(grow_ms, time_ms([&] {
+            for (std::size_t i = 0; i < count; ++i) v.push_back(p);
+        }));
+        insert_ms = std::min(insert_ms, time_ms([&] {
+            for (int i = 0; i < 10; ++i) v.insert(v.begin() + v.size() / 2, p);
+        }));
+        erase_ms = std::min(erase_ms, time_ms([&] {
+            for (int i = 0; i < 10; ++i) v.erase(v.begin() + v.size() / 2);
+        }));
+    }
+    std::printf("%-36s push_back %8.2f ms, 10 inserts %8.2f ms, 10 erases %8.2f ms\n",
+                name, grow_ms, insert_ms, erase_ms);
+}
+
+void report_pointer_vectors() {
+    bench_pointer_vector<smart_vector<smart_ptr<Point>>>("smart_vector<smart_ptr<Point>>", make_smart<Point>());
+    bench_pointer_vector<std::vector<smart_ptr<Point>>>("std::vector<smart_ptr<Point>>", make_smart<Point>());
+    bench_pointer_vector<std::vector<std::shared_ptr<Point>>>("std::vector<std::shared_ptr<Point>>",
+                                                               std::make_shared<Point>());
+}
+
+// Usage: Benchmark [--format=console|csv|json] [filter]. Runs only the
+// benchmarks whose name contains filter. Benchmark --check instead runs
+// the correctness checks, which allocate far more than any benchmark, and
+// exits with their result.
+int main(int argc, char** argv) {
+    benchmarks::format format = benchmarks::format::console;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--check") return check_empty_slots() && check_chain_teardown() ? EXIT_SUCCESS : EXIT_FAILURE;
+        else if (arg == "--format=csv") format = benchmarks::format::csv;
+        else if (arg == "--format=json") format = benchmarks::format::json;
+        else if (arg == "--format=console") format = benchmarks::format::console;
+        else if (arg.rfind("--", 0) == 0) {
+            std::fprintf(stderr, "usage: %s --check | [--format=console|csv|json] [filter]\n", argv[0]);
+            return EXIT_FAILURE;
+        } else filter = argv[i];
+    }
+
+    add_pointer_benchmarks<construct_raw>("construct_raw");
+    add_pointer_benchmarks<make>("make");
+    add_pointer_benchmarks<copy_construct>("copy_construct");
+    add_pointer_benchmarks<move_construct>("move_construct");
+    add_pointer_benchmarks<copy_assign>("copy_assign");
+    add_pointer_benchmarks<move_assign>("move_assign");
+    add_pointer_benchmarks<clone_object>("clone");
+    add_pointer_benchmarks<alias_member>("alias_member");
+    add_pointer_benchmarks<dereference>("dereference");
+    add_pointer_benchmarks<destroy>("destroy");
+    benchmarks::add("make_array_4096/smart_ptr", make_array<alignof(float)>);
+    benchmarks::add("make_array_4096/smart_ptr, 64-byte aligned", make_array<64>);
+    benchmarks::add("make_array_for_overwrite_4096/smart_ptr", make_array_for_overwrite<alignof(float)>);
+    benchmarks::add("make_array_for_overwrite_4096/smart_ptr, 64-byte aligned", make_array_for_overwrite<64>);
+#if defined(__cpp_lib_smart_ptr_for_overwrite)
+    benchmarks::add("make_array_4096/std::shared_ptr", make_shared_array);
+    benchmarks::add("make_array_for_overwrite_4096/std::shared_ptr", make_shared_array_for_overwrite);
+#endif
+    benchmarks::add("deref_loop_256/throw_on_null", deref_loop<throw_on_null>);
+    benchmarks::add("deref_loop_256/assert_not_null", deref_loop<assert_not_null>);
+    benchmarks::add("deref_loop_256/trap_on_null", deref_loop<trap_on_null>);
+    benchmarks::add("deref_loop_256/unchecked", deref_loop<unchecked>);
+    benchmarks::add("deref_loop_256/try_get", deref_loop_try_get);
+    benchmarks::add("pass_to_helper/smart_ptr by value", pass_to_helper<read_by_value>);
+    benchmarks::add("pass_to_helper/smart_ref", pass_to_helper<read_by_ref>);
+
+    benchmarks::add_report("copy/destroy throughput", report_copy_destroy);
+    benchmarks::add_report("owner-local copy/destroy, 95% on the creating thread", report_owner_local);
+    benchmarks::add_report("control block churn", report_churn);
+    benchmarks::add_report("snapshot reads with one writer", report_snapshots);
+    benchmarks::add_report("read-mostly config", bench_read_mostly);
+    benchmarks::add_report("containers of 1000000 nodes", report_containers);
+    benchmarks::add_report("vectors of 10M pointers", report_pointer_vectors);
+    benchmarks::add_report("chain teardown", report_chain_teardown);
+    benchmarks::add_report("last-release latency, 20000-node map", report_release_latency);
+    benchmarks::add_report("budgeted reclamation of a 1M-node tree", report_budgeted_reclaim);
+#if __has_include(<sys/mman.h>)
+    benchmarks::add_report("256 MB data file, read() vs map_file()", report_mapped_file);
+#endif
+#if defined(__linux__)
+    benchmarks::add_report("copies in forked workers", report_fork_rss);
+#endif
+
+    benchmarks::run(filter, format);
+}
@@ -0,0 +1,170 @@
+#ifndef atomic_smart_ptr_h
+#define atomic_smart_ptr_h
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include "smart_ptr.h"
+
+// A smart_ptr slot that readers can load() while writers replace it, with
+// no mutex on either side.
+//
+// Uses split reference counts. Each stored value lives in a node, and the
+// slot packs the node address with an external count of readers currently
+// copying out of it. A reader bumps that count, copies the smart_ptr, and
+// then gives its pin back: through the slot if the node is still current,
+// otherwise through the node's internal count. The writer that swaps a node
+// out moves the external count into the internal one, and whoever brings
+// the internal count to zero frees the node.
+template <typename T>
+class atomic_smart_ptr {
+public:
+    using value_type = smart_ptr<T, multi_threaded>;
+
+    atomic_smart_ptr() noexcept :
+    state_(0) {}
+
+    explicit atomic_smart_ptr(value_type desired) :
+    state_(pack(make_node(std::move(desired)))) {}
+
+    atomic_smart_ptr(const atomic_smart_ptr&) = delete;
+    atomic_smart_ptr& operator=(const atomic_smart_ptr&) = delete;
+
+    ~atomic_smart_ptr() {
+        if (node* n = unpack(state_.load(std::memory_order_acquire))) free_node(n);
+    }
+
+    bool is_lock_free() const noexcept {
+        return state_.is_lock_free();
+    }
+
+    value_type load() const noexcept {
+        std::uintptr_t pinned = pin();
+        node* n = unpack(pinned);
+        if (!n) return value_type();
+        value_type result = n->value;
+        unpin(n);
+        return result;
+    }
+
+    void store(value_type desired) {
+        exchange(std::move(desired));
+    }
+
+    value_type exchange(value_type desired) {
+        node* fresh = make_node(std::move(desired));
+        std::uintptr_t old = state_.exchange(pack(fresh), std::memory_order_acq_rel);
+        node* n = unpack(old);
+        if (!n) return value_type();
+        value_type result = n->value;
+        retire(n, external(old));
+        return result;
+    }
+
+    // Succeeds if the slot holds the same object as expected; otherwise
+    // loads the current value into expected.
+    bool compare_exchange_strong(value_type& expected, value_type desired) {
+        node* fresh = nullptr;
+        for (;;) {
+            std::uintptr_t pinned = pin();
+            node* n = unpack(pinned);
+            if (!same(n, expected)) {
+                expected = n ? n->value : value_type();
+                if (n) unpin(n);
+                if (fresh) free_node(fresh);
+                return false;
+            }
+            if (!fresh) fresh = make_node(std::move(desired));
+
+            // Our own pin is part of the count we hand over, so swap only
+            // while the slot still names n, whatever the count is now.
+            std::uintptr_t cur = state_.load(std::memory_order_relaxed);
+            while (unpack(cur) == n) {
+                if (state_.compare_exchange_weak(cur, pack(fresh), std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed)) {
+                    if (n) retire(n, external(cur) - 1);
+                    return true;
+                }
+            }
+            if (n) unpin(n);
+        }
+    }
+
+    bool compare_exchange_weak(value_type& expected, value_type desired) {
+        return compare_exchange_strong(expected, std::move(desired));
+    }
+
+private:
+    struct node {
+        value_type value;
+        std::atomic<int> internal;     // pins moved here when swapped out, minus pins returned
+
+        explicit node(value_type v) noexcept : value(std::move(v)), internal(0) {}
+    };
+
+    // Node addresses must fit in the low 48 bits, which holds for untagged
+    // x86-64 and arm64 user-space pointers; the top 16 hold the external
+    // count. Allocators that tag the top byte (arm64 TBI, MTE heap tags)
+    // break this, which make_node() asserts.
+    static_assert(sizeof(std::uintptr_t) == 8, "atomic_smart_ptr needs 64-bit pointers");
+    static constexpr int count_shift = 48;
+    static constexpr std::uintptr_t one = std::uintptr_t(1) << count_shift;
+    static constexpr std::uintptr_t address_mask = one - 1;
+
+    mutable std::atomic<std::uintptr_t> state_;   // node address | external count << 48
+
+    static std::uintptr_t pack(node* n) noexcept {
+        return reinterpret_cast<std::uintptr_t>(n);
+    }
+
+    static node* unpack(std::uintptr_t s) noexcept {
+        return reinterpret_cast<node*>(s & address_mask);
+    }
+
+    static int external(std::uintptr_t s) noexcept {
+        return static_cast<int>(s >> count_shift);
+    }
+
+    static node* make_node(value_type v) {
+        if (!v.ref_) return nullptr;
+        node* n = new_block<node>(pool_allocator<node>(), std::move(v));
+        assert((pack(n) & ~address_mask) == 0 && "node address does not fit in 48 bits");
+        return n;
+    }
+
+    static void free_node(node* n) noexcept {
+        delete_block(n, pool_allocator<node>());
+    }
+
+    static bool same(node* n, const value_type& v) noexcept {
+        if (!n) return !v.ref_;
+        return n->value.ptr_ == v.ptr_ && n->value.ref_ == v.ref_;
+    }
+
+    // Adds one to the external count of the current node, if there is one,
+    // and returns the pinned state.
+    std::uintptr_t pin() const noexcept {
+        std::uintptr_t cur = state_.load(std::memory_order_relaxed);
+        while (unpack(cur) &&
+               !state_.compare_exchange_weak(cur, cur + one, std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {}
+        return unpack(cur) ? cur + one : cur;
+    }
+
+    void unpin(node* n) const noexcept {
+        std::uintptr_t cur = state_.load(std::memory_order_relaxed);
+        while (unpack(cur) == n) {
+            if (state_.compare_exchange_weak(cur, cur - one, std::memory_order_release,
+                                             std::memory_order_relaxed)) return;
+        }
+        if (n->internal.fetch_sub(1, std::memory_order_acq_rel) == 1) free_node(n);
+    }
+
+    // Called once n has left the slot with pins still outstanding.
+    static void retire(node* n, int pins) noexcept {
+        if (n->internal.fetch_add(pins, std::memory_order_acq_rel) == -pins) free_node(n);
+    }
+};
+
+#endif /* atomic_smart_ptr_h */
@@ -0,0 +1,224 @@
+#ifndef block_pool_h
+#define block_pool_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Size-class slab allocator for control blocks and other small objects.
+//
+// Every thread allocates from its own cache of free lists, one per 16-byte
+// size class, without locks. A slab belongs to the cache that carved it; a
+// block freed on another thread is pushed onto that cache's remote list and
+// taken back in one batch the next time the owner runs dry. Slabs are kept
+// for reuse rather than returned to the system, and the cache of an exited
+// thread is handed to the next thread that starts.
+class block_pool {
+public:
+    static constexpr std::size_t granularity = 16;
+    static constexpr std::size_t max_size = 128;          // larger requests use operator new
+    static constexpr std::size_t slab_size = 64 * 1024;
+
+    struct pool_stats {
+        std::size_t blocks_live;       // handed out and not yet freed
+        std::size_t blocks_cached;     // sitting in thread free lists
+        std::size_t blocks_remote;     // freed remotely, not yet back in the owner's lists
+        std::size_t remote_frees;      // freed by a thread other than the owner
+    };
+
+    static void* allocate(std::size_t size) {
+        if (size > max_size) return ::operator new(size);
+        thread_cache& cache = local();
+        std::size_t c = size_class(size);
+        free_block* b = cache.free_lists[c];
+        if (!b) b = cache.refill(c);
+        cache.free_lists[c] = b->next;
+        bump(cache.allocated, 1);
+        bump(cache.cached, -1);
+        return b;
+    }
+
+    // A thread that has never allocated from the pool has no cache, so
+    // everything it frees takes the remote path.
+    static void deallocate(void* p, std::size_t size) noexcept {
+        if (size > max_size) {
+            ::operator delete(p);
+            return;
+        }
+        auto* b = static_cast<free_block*>(p);
+        thread_cache* owner = slab_of(p)->owner;
+        if (owner == current_) {
+            std::size_t c = size_class(size);
+            b->next = owner->free_lists[c];
+            owner->free_lists[c] = b;
+            bump(owner->freed, 1);
+            bump(owner->cached, 1);
+            return;
+        }
+        b->next = owner->remote.load(std::memory_order_relaxed);
+        while (!owner->remote.compare_exchange_weak(b->next, b, std::memory_order_release,
+                                                    std::memory_order_relaxed)) {}
+        owner->remote_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static pool_stats stats() {
+        registry& r = caches();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::size_t allocated = 0, freed = 0, cached = 0, remote = 0, drained = 0;
+        for (thread_cache* cache : r.all) {
+            allocated += cache->allocated.load(std::memory_order_relaxed);
+            freed += cache->freed.load(std::memory_order_relaxed);
+            cached += cache->cached.load(std::memory_order_relaxed);
+            remote += cache->remote_frees.load(std::memory_order_relaxed);
+            drained += cache->drained.load(std::memory_order_relaxed);
+        }
+        return { allocated - freed - remote, cached, remote - drained, remote };
+    }
+
+private:
+    static constexpr std::size_t classes = max_size / granularity;
+
+    struct free_block {
+        free_block* next;
+    };
+
+    struct thread_cache;
+
+    // Sits at the start of every slab; slabs are aligned to their size so a
+    // block finds its header by masking its address.
+    struct alignas(granularity) slab_header {
+        thread_cache* owner;
+        std::size_t size_class;
+    };
+
+    struct thread_cache {
+        free_block* free_lists[classes] {};
+        std::atomic<free_block*> remote { nullptr };    // blocks freed by other threads
+
+        // Written only by the owning thread; atomic so stats() can read them.
+        std::atomic<std::size_t> allocated { 0 };
+        std::atomic<std::size_t> freed { 0 };
+        std::atomic<std::size_t> cached { 0 };
+        std::atomic<std::size_t> remote_frees { 0 };     // received from other threads
+        std::atomic<std::size_t> drained { 0 };          // of those, moved to free_lists
+
+        free_block* refill(std::size_t c) {
+            for (free_block* b = remote.exchange(nullptr, std::memory_order_acquire); b;) {
+                free_block* next = b->next;
+                std::size_t bc = slab_of(b)->size_class;
+                b->next = free_lists[bc];
+                free_lists[bc] = b;
+                bump(cached, 1);
+                bump(drained, 1);
+                b = next;
+            }
+            if (free_lists[c]) return free_lists[c];
+
+            void* memory = ::operator new(slab_size, std::align_val_t(slab_size));
+            auto* slab = ::new (memory) slab_header { this, c };
+            std::size_t block_size = (c + 1) * granularity;
+            auto* first = reinterpret_cast<unsigned char*>(slab) + sizeof(slab_header);
+            std::size_t n = (slab_size - sizeof(slab_header)) / block_size;
+            for (std::size_t i = n; i-- > 0;) {
+                auto* b = reinterpret_cast<free_block*>(first + i * block_size);
+                b->next = free_lists[c];
+                free_lists[c] = b;
+            }
+            bump(cached, n);
+            return free_lists[c];
+        }
+    };
+
+    // Hands the calling thread's cache back to the pool when it exits.
+    struct cache_guard {
+        thread_cache* cache = nullptr;
+
+        ~cache_guard() {
+            current_ = nullptr;
+            if (!cache) return;
+            registry& r = caches();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.orphans.push_back(cache);
+        }
+    };
+
+    struct registry {
+        std::mutex mutex;
+        std::vector<thread_cache*> all;        // every cache ever created
+        std::vector<thread_cache*> orphans;    // caches of exited threads
+    };
+
+    static inline thread_local thread_cache* current_ = nullptr;
+
+    // Never destroyed: blocks may still be freed by threads that outlive
+    // static destruction.
+    static registry& caches() {
+        static registry* r = new registry;
+        return *r;
+    }
+
+    static std::size_t size_class(std::size_t size) noexcept {
+        return size ? (size - 1) / granularity : 0;
+    }
+
+    static slab_header* slab_of(void* p) noexcept {
+        return reinterpret_cast<slab_header*>(reinterpret_cast<std::uintptr_t>(p) & ~(slab_size - 1));
+    }
+
+    static void bump(std::atomic<std::size_t>& counter, std::ptrdiff_t by) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    static thread_cache& local() {
+        if (current_) return *current_;
+
+        static thread_local cache_guard guard;
+        registry& r = caches();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (!r.orphans.empty()) {
+            current_ = r.orphans.back();
+            r.orphans.pop_back();
+        } else {
+            current_ = new thread_cache;
+            r.all.push_back(current_);
+        }
+        guard.cache = current_;
+        return *current_;
+    }
+};
+
+// Standard allocator over block_pool, used by default for the control
+// blocks of smart_ptrs built from raw pointers. Over-aligned types bypass
+// the pool.
+template <typename T>
+struct pool_allocator {
+    using value_type = T;
+
+    pool_allocator() noexcept = default;
+    template <typename U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if constexpr (alignof(T) > block_pool::granularity) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        } else {
+            return static_cast<T*>(block_pool::allocate(n * sizeof(T)));
+        }
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if constexpr (alignof(T) > block_pool::granularity) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        } else {
+            block_pool::deallocate(p, n * sizeof(T));
+        }
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U>&) const noexcept { return true; }
+};
+
+#endif /* block_pool_h */
@@ -0,0 +1,52 @@
+#ifndef cow_ptr_h
+#define cow_ptr_h
+
+#include <utility>
+#include "smart_ptr.h"
+
+// Copy-on-write handle over smart_ptr. Copies share one object and only
+// get const access to it; mut() detaches with smart_ptr::clone() when the
+// object is shared, so a copy is paid for only on the first write.
+template <typename T, typename Count = single_threaded>
+class cow_ptr {
+public:
+    cow_ptr() noexcept = default;
+
+    explicit cow_ptr(T* &&raw_ptr) :
+    ptr_(std::move(raw_ptr)) {}
+
+    explicit cow_ptr(smart_ptr<T, Count> sp) noexcept :
+    ptr_(std::move(sp)) {}
+
+    const T& operator*() const {
+        return *ptr_;
+    }
+
+    const T* operator->() const {
+        return ptr_.operator->();
+    }
+
+    // Throws sliced_clone_exception if the object is shared and was made
+    // as a class derived from T; see smart_ptr::clone().
+    T& mut() {
+        ptr_.clone();
+        return *ptr_;
+    }
+
+    int ref_count() const noexcept {
+        return ptr_.ref_count();
+    }
+
+private:
+    smart_ptr<T, Count> ptr_;   // shared object, only written through mut()
+};
+
+template <typename T, typename Count = single_threaded, typename... Args>
+cow_ptr<T, Count> make_cow(Args&&... args) {
+    return cow_ptr<T, Count>(make_smart<T, Count>(std::forward<Args>(args)...));
+}
+
+template <typename T, typename Count>
+inline constexpr bool is_trivially_relocatable<cow_ptr<T, Count>> = true;
+
+#endif /* cow_ptr_h */
@@ -0,0 +1,128 @@
+#ifndef intrusive_smart_ptr_h
+#define intrusive_smart_ptr_h
+
+#include <type_traits>
+#include "smart_ptr.h"
+
+// Base for types that carry their own reference count. Derive as
+// struct Node : ref_counted<Node> { ... }; and manage with intrusive_smart_ptr.
+// Copying the object does not copy the count.
+template <typename T, typename Count = single_threaded>
+class ref_counted {
+public:
+    using count_policy = Count;
+
+protected:
+    ref_counted() noexcept : count(0) {}
+    ref_counted(const ref_counted&) noexcept : count(0) {}
+    ref_counted& operator=(const ref_counted&) noexcept { return *this; }
+    ~ref_counted() = default;
+
+private:
+    typename Count::count_type count;   // number of intrusive_smart_ptrs sharing the object
+
+    friend Count;
+    template <typename U>
+    friend class intrusive_smart_ptr;
+};
+
+// One-pointer smart pointer for ref_counted types. Same surface as smart_ptr.
+template <typename T>
+class intrusive_smart_ptr {
+    using Count = typename T::count_policy;
+    using base = ref_counted<T, Count>;
+    static_assert(!std::is_same_v<Count, biased>, "biased counting needs a control block");
+    static_assert(!requires { requires Count::lazy_block; }, "unique_first counting needs a smart_ptr");
+
+public:
+    intrusive_smart_ptr() noexcept :
+    ptr_(nullptr) {}
+
+    explicit intrusive_smart_ptr(T* &raw_ptr) noexcept :
+    ptr_(raw_ptr) {
+        if (ptr_) Count::increment(counted());
+    }
+
+    explicit intrusive_smart_ptr(T* &&raw_ptr) noexcept :
+    ptr_(raw_ptr) {
+        if (ptr_) Count::increment(counted());
+        raw_ptr = nullptr;
+    }
+
+    intrusive_smart_ptr(const intrusive_smart_ptr& rhs) noexcept :
+    ptr_(rhs.ptr_) {
+        if (ptr_) Count::increment(counted());
+    }
+
+    intrusive_smart_ptr(intrusive_smart_ptr&& rhs) noexcept :
+    ptr_(rhs.ptr_) {
+        rhs.ptr_ = nullptr;
+    }
+
+    // rhs may live inside the object being released.
+    intrusive_smart_ptr& operator=(const intrusive_smart_ptr& rhs) noexcept {
+        if (this != &rhs) {
+            T* ptr = rhs.ptr_;
+            if (ptr) Count::increment(*static_cast<base*>(ptr));
+            release();
+            ptr_ = ptr;
+        }
+        return *this;
+    }
+
+    intrusive_smart_ptr& operator=(intrusive_smart_ptr&& rhs) noexcept {
+        if (this != &rhs) {
+            T* ptr = rhs.ptr_;
+            rhs.ptr_ = nullptr;
+            release();
+            ptr_ = ptr;
+        }
+        return *this;
+    }
+
+    bool clone() {
+        if (!ptr_ || Count::load(counted()) == 1) return false;
+        T* new_ptr = new T(*ptr_);
+        release();
+        ptr_ = new_ptr;
+        Count::increment(counted());
+        return true;
+    }
+
+    int ref_count() const noexcept {
+        return ptr_ ? Count::load(counted()) : 0;
+    }
+
+    T& operator*() const {
+        if (!ptr_) throw null_ptr_exception();
+        return *ptr_;
+    }
+
+    T* operator->() const {
+        if (!ptr_) throw null_ptr_exception();
+        return ptr_;
+    }
+
+    ~intrusive_smart_ptr() {
+        release();
+    }
+
+private:
+    T* ptr_;               // pointer to the referred object, which holds the count
+
+    base& counted() const noexcept {
+        return *ptr_;
+    }
+
+    void release() noexcept {
+        if (ptr_ && Count::decrement(counted())) {
+            delete ptr_;
+        }
+        ptr_ = nullptr;
+    }
+};
+
+template <typename T>
+inline constexpr bool is_trivially_relocatable<intrusive_smart_ptr<T>> = true;
+
+#endif /* intrusive_smart_ptr_h */
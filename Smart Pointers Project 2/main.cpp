@@ -1,106 +1,17 @@
+#include <cstdlib>
 #include <iostream>
-#include <exception>
+#include "smart_ptr.h"
+#include "cow_ptr.h"
+#include "shared_buffer.h"
+#include "intrusive_smart_ptr.h"
 using namespace std;
 
-struct null_ptr_exception : public std::exception {
-    const char* what() const noexcept override {
-        return "Attempting to access a null pointer";
-    }
-};
-
-template <typename T>
-class smart_ptr {
-public:
-    smart_ptr() noexcept : 
-    ptr_(nullptr),
-    ref_(new int(0)) {}
- 
-    explicit smart_ptr(T* &raw_ptr) noexcept : 
-    ptr_(raw_ptr),
-    ref_(new int(1)) {}
-      
-    explicit smart_ptr(T* &&raw_ptr) noexcept : 
-    ptr_(raw_ptr),
-    ref_(new int(1)) {
-        raw_ptr = nullptr;
-    }
-
-    smart_ptr(const smart_ptr& rhs) noexcept : 
-    ptr_(rhs.ptr_),
-    ref_(rhs.ref_) {
-        if (ptr_) (*ref_)++;
-    }
-
-    smart_ptr(smart_ptr&& rhs) noexcept : 
-    ptr_(rhs.ptr_),
-    ref_(rhs.ref_) {
-        rhs.ptr_ = nullptr;
-        rhs.ref_ = nullptr;
-    }
-
-    smart_ptr& operator=(const smart_ptr& rhs) noexcept {
-        if (this != &rhs) {
-            release();
-            ptr_ = rhs.ptr_;
-            ref_ = rhs.ref_;
-            if (ptr_) (*ref_)++;
-        }
-        return *this;
-    }
-
-    smart_ptr& operator=(smart_ptr&& rhs) noexcept {
-        if (this!= &rhs) {
-            release();
-            ptr_ = rhs.ptr_;
-            ref_ = rhs.ref_;
-            rhs.ptr_ = nullptr;
-            rhs.red_ = nullptr;
-        }
-        return *this;
-    }
-      
-    bool clone() {
-        if (!ptr_ || *ref_ == 1) return false;
-        T* new_ptr = new T(*ptr_);
-        --(*ref_);
-        ptr_ = new_ptr;
-        ref_ = new int(1);
-        return true;
-    }
-      
-    int ref_count() const noexcept {
-        return *ref_;
-    }
-
-    T& operator*() const {
-        if (!ptr_) throw null_ptr_exception();
-        return *ptr_;
-    }
-
-    T* operator->() const {
-        if (!ptr_) throw null_ptr_exception();
-        return ptr_;
-    }
+struct Point { int x = 2; int y = -5; };
 
-    ~smart_ptr() { 
-        release();
-    }
-    
-private:
-    T* ptr_;               // pointer to the referred object
-    int* ref_;             // pointer to a reference count
-    
-    void release() {
-        if (ref_ && --(*ref_) == 0) {
-            delete ptr_;
-            delete ref_;
-        }
-        ptr_ = nullptr;
-        ref_ = nullptr;
-    }
-};
+struct Node : ref_counted<Node> { int value = 11; };
 
-struct Point { int x = 2; int y = -5; };
+struct Shape { virtual ~Shape() = default; virtual int sides() const = 0; };
+struct Square : Shape { int sides() const override { return 4; } };
 
 int main() {
     int* p { new int { 42 } };
@@ -128,10 +39,55 @@ int main() {
     smart_ptr<int> sp4 { std::move(sp1) };
 
     cout << *sp4 << " " << *sp3 << endl;        // prints 42 42
+    cout << sp1.ref_count() << endl;             // prints 0, sp1 was moved from
      //cout << *sp1 << endl;                       // throws null_ptr_exception
      
     smart_ptr<Point> sp { new Point };
            cout << sp->x << " " << sp->y << endl;   // prints 2 -5
+
+    smart_ptr<Point> msp { make_smart<Point>() };    // object and count in one allocation
+           cout << msp->x << " " << msp->y << " " << msp.ref_count() << endl;   // prints 2 -5 1
+
+    smart_ptr<const Point> csp1 { make_smart<const Point>() };   // read-only object
+           cout << csp1->x << " " << csp1.ref_count() << endl;   // prints 2 1
+
+    weak_smart_ptr<int> wp;
+    {
+        smart_ptr<int> tmp { new int { 7 } };
+        wp = tmp;
+        cout << wp.expired() << " " << *wp.lock() << endl;   // prints 0 7
+    }
+    cout << wp.expired() << " " << wp.ref_count() << endl;   // prints 1 0
+
+    intrusive_smart_ptr<Node> isp1 { new Node };             // count lives inside Node
+    intrusive_smart_ptr<Node> isp2 { isp1 };
+    cout << isp1->value << " " << isp2.ref_count() << " " << sizeof(isp1) << endl;   // prints 11 2 8
+
+    smart_ptr<int> csp { static_cast<int*>(malloc(sizeof(int))), [](int* p) { free(p); } };   // released with free()
+    *csp = 5;
+    smart_ptr<int> asp { allocate_smart<int>(allocator<int>(), 6) };   // block and object from the allocator
+    cout << *csp << " " << *asp << endl;        // prints 5 6
+
+    smart_ptr<Point, single_threaded, unchecked> usp { msp };   // same object, no null check on ->
+    cout << usp->y << " " << msp.ref_count() << " " << (sp1.try_get() == nullptr) << endl;   // prints -5 2 1
+
+    smart_ptr<Shape> shape { make_smart<Square>() };            // converts to the base class
+    smart_ptr<Square> square { dynamic_pointer_cast<Square>(shape) };
+    smart_ptr<int> px { msp, &msp->x };                         // points at x, keeps the Point alive
+    cout << shape->sides() << " " << square.ref_count() << " " << *px << " " << msp.ref_count() << endl;   // prints 4 2 2 3
+
+    smart_ptr<float[]> buf { make_smart<float[]>(8, 64) };     // 8 zeroed floats, 64-byte aligned
+    buf[7] = 1.5f;
+    cout << buf.size() << " " << buf[0] << " " << buf[7] << endl;   // prints 8 0 1.5
+
+    shared_buffer<> packet { shared_buffer<>::copy_of("HEADbody", 8) };
+    shared_buffer<> body { packet.slice(4) };                   // no copy, shares packet's block
+    cout << body.size() << " " << char(body.data()[0]) << " " << packet.ref_count() << endl;   // prints 4 b 2
+
+    cow_ptr<Point> cp1 { make_cow<Point>() };
+    cow_ptr<Point> cp2 { cp1 };
+    cp2.mut().x = 9;                            // cp2 detaches before the write
+    cout << cp1->x << " " << cp2->x << " " << cp1.ref_count() << endl;   // prints 2 9 1
     
     smart_ptr<double> dsp1 { new double {3.14} };
         smart_ptr<double> dsp2, dsp3;
@@ -0,0 +1,114 @@
+#ifndef mapped_file_h
+#define mapped_file_h
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include "smart_ptr.h"
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only file mappings owned through smart_ptr<const std::byte[]>. Pages
+// are read in from the file on first touch, so mapping costs the same for a
+// 10 GB file as for a small one, and the last smart_ptr into the mapping,
+// including typed views, munmaps it:
+//     auto bytes = map_file<>("index.bin", map_advice::random);
+//     auto entries = view_as<Entry>(bytes, header_size, count);
+
+enum class map_advice { normal, sequential, random, will_need };
+
+// Deleter for a mapping; length is what was passed to mmap().
+struct munmap_delete {
+    std::size_t length;
+
+    void operator()(const std::byte* p) const noexcept {
+        ::munmap(const_cast<std::byte*>(p), length);
+    }
+};
+
+inline std::size_t page_size() noexcept {
+    static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+// Passes hint to madvise() for the pages spanned by bytes. Advice is
+// only a hint, so failures are ignored.
+template <typename Count, typename Check>
+void advise(const smart_ptr<const std::byte[], Count, Check>& bytes, map_advice hint) noexcept {
+    if (bytes.size() == 0) return;
+    static constexpr int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+    auto first = reinterpret_cast<std::uintptr_t>(bytes.try_get());
+    std::uintptr_t start = first & ~(page_size() - 1);
+    ::madvise(reinterpret_cast<void*>(start), first + bytes.size() - start, advice[static_cast<int>(hint)]);
+}
+
+// Maps length bytes of the file at path starting at offset, or everything
+// from offset to the end if length is SIZE_MAX. The mapping is rounded out
+// to whole pages; the result covers exactly the requested bytes. Throws
+// std::system_error if the file cannot be opened or mapped and
+// std::out_of_range if the range is not inside the file. An empty range
+// gives an empty smart_ptr.
+template <typename Count = single_threaded>
+smart_ptr<const std::byte[], Count> map_file(const char* path, std::size_t offset, std::size_t length,
+                                            map_advice hint = map_advice::normal) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "map_file: open");
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "map_file: fstat");
+    }
+    auto file_size = static_cast<std::size_t>(st.st_size);
+    if (offset > file_size || (length != SIZE_MAX && length > file_size - offset)) {
+        ::close(fd);
+        throw std::out_of_range("map_file");
+    }
+    if (length == SIZE_MAX) length = file_size - offset;
+    if (length == 0) {
+        ::close(fd);
+        return {};
+    }
+
+    std::size_t start = offset & ~(page_size() - 1);
+    std::size_t mapped = offset - start + length;
+    void* p = ::mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(start));
+    int error = errno;
+    ::close(fd);   // the mapping keeps the file open
+    if (p == MAP_FAILED) throw std::system_error(error, std::generic_category(), "map_file: mmap");
+
+    auto* base = static_cast<const std::byte*>(p);
+    smart_ptr<const std::byte[], Count> pages { base, mapped, munmap_delete { mapped }, pool_allocator<std::byte>() };
+    smart_ptr<const std::byte[], Count> bytes { pages, base + (offset - start), length };
+    if (hint != map_advice::normal) advise(bytes, hint);
+    return bytes;
+}
+
+template <typename Count = single_threaded>
+smart_ptr<const std::byte[], Count> map_file(const char* path, map_advice hint = map_advice::normal) {
+    return map_file<Count>(path, 0, SIZE_MAX, hint);
+}
+
+// count objects of type T starting offset bytes into bytes, sharing its
+// mapping. Throws std::out_of_range if they do not fit and
+// std::invalid_argument if they would be misaligned.
+template <typename T, typename Count, typename Check>
+    requires std::is_trivially_copyable_v<T>
+smart_ptr<const T[], Count> view_as(const smart_ptr<const std::byte[], Count, Check>& bytes,
+                                    std::size_t offset, std::size_t count) {
+    if (offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T)) throw std::out_of_range("view_as");
+    const std::byte* first = bytes.try_get() + offset;
+    if (reinterpret_cast<std::uintptr_t>(first) % alignof(T)) throw std::invalid_argument("view_as: misaligned");
+    return smart_ptr<const T[], Count>(bytes, reinterpret_cast<const T*>(first), count);
+}
+
+#endif
+
+#endif /* mapped_file_h */
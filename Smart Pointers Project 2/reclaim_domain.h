@@ -0,0 +1,269 @@
+#ifndef reclaim_domain_h
+#define reclaim_domain_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include "block_pool.h"
+
+// Objects waiting to be destroyed somewhere other than where their last
+// reference was dropped. Any thread may retire() an object with a lock-free
+// push; one thread at a time reclaims them, oldest first. reclaim() can be
+// given a budget, so a worker can spread the destruction of a large
+// structure over many ticks: objects that a destructor retires join the
+// back of the queue rather than being destroyed recursively.
+class reclaim_domain {
+    using clock = std::chrono::steady_clock;
+
+public:
+    using destroy_fn = void (*)(void*) noexcept;
+
+    // Limits on one reclaim() call; it stops at whichever runs out first.
+    struct budget {
+        std::size_t objects = SIZE_MAX;
+        std::chrono::nanoseconds time = std::chrono::nanoseconds::max();
+    };
+
+    struct domain_stats {
+        std::size_t queued;                 // retired and not yet destroyed
+        std::size_t reclaimed;              // destroyed so far
+        std::chrono::nanoseconds oldest;    // age of the oldest queued object
+        std::chrono::nanoseconds max_age;   // largest such age seen by reclaim()
+    };
+
+    reclaim_domain() noexcept = default;
+    reclaim_domain(const reclaim_domain&) = delete;
+    reclaim_domain& operator=(const reclaim_domain&) = delete;
+
+    // Destroys whatever is still queued.
+    ~reclaim_domain() {
+        reclaim();
+    }
+
+    // Queues destroy(object). If the queue entry cannot be allocated the
+    // object is destroyed right away instead.
+    void retire(void* object, destroy_fn destroy) noexcept {
+        entry* e;
+        try {
+            e = pool_allocator<entry>().allocate(1);
+        } catch (...) {
+            destroy(object);
+            return;
+        }
+        e->object = object;
+        e->destroy = destroy;
+        e->retired_at = clock::now();
+        retired_.fetch_add(1, std::memory_order_relaxed);
+        // e belongs to the reclaimer once pushed, so keep the old head here.
+        entry* old = head_.load(std::memory_order_relaxed);
+        do {
+            e->next = old;
+        } while (!head_.compare_exchange_weak(old, e, std::memory_order_release,
+                                              std::memory_order_relaxed));
+        if (!old) wake();
+    }
+
+    // Destroys everything queued, including whatever those destructors
+    // retire in turn, and returns how many objects that was.
+    std::size_t reclaim() noexcept {
+        return reclaim(budget {});
+    }
+
+    // Destroys queued objects, oldest first, until the queue is empty or
+    // the budget runs out, and returns how many it destroyed.
+    std::size_t reclaim(budget limit) noexcept {
+        clock::time_point start = clock::now();
+        bool timed = limit.time != std::chrono::nanoseconds::max();
+        take_all();
+        if (backlog_) max_age_ = std::max(max_age_, clock::duration(start - backlog_->retired_at));
+
+        std::size_t n = 0;
+        for (; n < limit.objects; ++n) {
+            if (!backlog_ && !take_all()) break;
+            if (timed && clock::now() - start >= limit.time) break;
+            entry* e = backlog_;
+            backlog_ = e->next;
+            e->destroy(e->object);
+            pool_allocator<entry>().deallocate(e, 1);
+            if (n % 64 == 63) publish(64);
+        }
+        publish(n % 64);
+        return n;
+    }
+
+    // Counters are exact only on the reclaiming thread, which is the one
+    // expected to call this.
+    domain_stats stats() noexcept {
+        take_all();
+        std::size_t reclaimed = reclaimed_.load(std::memory_order_relaxed);
+        clock::duration oldest = backlog_ ? clock::now() - backlog_->retired_at : clock::duration(0);
+        return { retired_.load(std::memory_order_relaxed) - reclaimed, reclaimed, oldest, max_age_ };
+    }
+
+    std::size_t retired() const noexcept {
+        return retired_.load(std::memory_order_relaxed);
+    }
+
+    std::size_t reclaimed() const noexcept {
+        return reclaimed_.load(std::memory_order_acquire);
+    }
+
+    // For a reclaiming thread that sleeps while the domain is empty: take
+    // signal() before reclaiming, then wait(seen). Returns once something
+    // is retired into an empty domain or wake() is called.
+    std::uint64_t signal() const noexcept {
+        return signal_.load(std::memory_order_acquire);
+    }
+
+    void wait(std::uint64_t seen) const noexcept {
+        signal_.wait(seen, std::memory_order_acquire);
+    }
+
+    void wake() noexcept {
+        signal_.fetch_add(1, std::memory_order_release);
+        signal_.notify_all();
+    }
+
+    // Blocks until reclaimed() reaches count.
+    void wait_reclaimed(std::size_t count) const noexcept {
+        for (std::size_t seen = reclaimed(); seen < count; seen = reclaimed())
+            reclaimed_.wait(seen, std::memory_order_acquire);
+    }
+
+private:
+    struct entry {
+        entry* next;
+        void* object;
+        destroy_fn destroy;
+        clock::time_point retired_at;
+    };
+
+    std::atomic<entry*> head_ { nullptr };         // newest first
+    std::atomic<std::size_t> retired_ { 0 };
+    std::atomic<std::size_t> reclaimed_ { 0 };
+    std::atomic<std::uint64_t> signal_ { 0 };
+
+    // Owned by the reclaiming thread: entries taken off head_, oldest first.
+    entry* backlog_ = nullptr;
+    entry* backlog_tail_ = nullptr;
+    clock::duration max_age_ { 0 };
+
+    // Moves everything pushed so far to the end of the backlog; false if
+    // there was nothing.
+    bool take_all() noexcept {
+        entry* e = head_.exchange(nullptr, std::memory_order_acquire);
+        if (!e) return false;
+        entry* oldest = nullptr;
+        entry* newest = e;
+        while (e) {
+            entry* next = e->next;
+            e->next = oldest;
+            oldest = e;
+            e = next;
+        }
+        if (backlog_) backlog_tail_->next = oldest;
+        else backlog_ = oldest;
+        backlog_tail_ = newest;
+        return true;
+    }
+
+    void publish(std::size_t n) noexcept {
+        if (!n) return;
+        reclaimed_.fetch_add(n, std::memory_order_release);
+        reclaimed_.notify_all();
+    }
+};
+
+// Process-wide domain reclaimed by a thread of its own, started on first
+// use. The thread sleeps while there is nothing to destroy.
+class background_reclaimer {
+public:
+    // Hands object to the reclaimer thread, or destroys it here once the
+    // reclaimer has been drained or could not be started.
+    static void retire(void* object, reclaim_domain::destroy_fn destroy) noexcept {
+        reclaimer& r = instance();
+        if (r.running.load(std::memory_order_acquire)) r.domain.retire(object, destroy);
+        else destroy(object);
+    }
+
+    // Waits until every object retired before the call has been destroyed.
+    // Must not be called from a destructor that the reclaimer runs.
+    static void flush() noexcept {
+        reclaimer& r = instance();
+        std::size_t target = r.domain.retired();
+        if (r.running.load(std::memory_order_acquire)) r.domain.wait_reclaimed(target);
+        else r.domain.reclaim();
+    }
+
+    // Flushes and stops the thread, for shutdown. Call it once no other
+    // thread releases deferred objects; later ones are destroyed inline.
+    static void drain() {
+        reclaimer& r = instance();
+        if (!r.running.exchange(false, std::memory_order_acq_rel)) return;
+        r.domain.wake();
+        r.thread.join();
+        r.domain.reclaim();
+    }
+
+private:
+    struct reclaimer {
+        reclaim_domain domain;
+        std::atomic<bool> running { false };
+        std::thread thread;
+
+        reclaimer() {
+            try {
+                running.store(true, std::memory_order_release);
+                thread = std::thread([this] { run(); });
+            } catch (...) {
+                running.store(false, std::memory_order_release);
+            }
+        }
+
+        void run() noexcept {
+            for (;;) {
+                std::uint64_t seen = domain.signal();
+                domain.reclaim();
+                if (!running.load(std::memory_order_acquire)) return;
+                domain.wait(seen);
+            }
+        }
+    };
+
+    // Never destroyed, like block_pool's registry: the thread may still be
+    // running during static destruction.
+    static reclaimer& instance() noexcept {
+        static reclaimer* r = new reclaimer;
+        return *r;
+    }
+};
+
+// Deleter that leaves the object to a reclaim_domain instead of deleting it
+// on the thread that dropped the last reference. By default that is the
+// background reclaimer's:
+//     smart_ptr<Blob> p { new Blob, deferred_delete<Blob>() };
+//     smart_ptr<Blob> q { new Blob, deferred_delete<Blob>(my_domain) };
+template <typename T>
+struct deferred_delete {
+    reclaim_domain* domain = nullptr;
+
+    deferred_delete() noexcept = default;
+
+    explicit deferred_delete(reclaim_domain& d) noexcept :
+    domain(&d) {}
+
+    void operator()(T* p) const noexcept {
+        if (domain) domain->retire(p, &destroy);
+        else background_reclaimer::retire(p, &destroy);
+    }
+
+private:
+    static void destroy(void* p) noexcept {
+        delete static_cast<T*>(p);
+    }
+};
+
+#endif /* reclaim_domain_h */
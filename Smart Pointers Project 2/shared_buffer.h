@@ -0,0 +1,145 @@
+#ifndef shared_buffer_h
+#define shared_buffer_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "smart_ptr.h"
+
+#if __has_include(<sys/uio.h>)
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// A range of bytes in a reference-counted block. Copies and slices share
+// the block instead of copying bytes, and the block is freed when the last
+// buffer or slice referring to it goes away.
+template <typename Count = single_threaded>
+class shared_buffer {
+public:
+    shared_buffer() noexcept = default;
+
+    // size bytes, left uninitialized for the caller to fill.
+    explicit shared_buffer(std::size_t size) :
+    bytes_(make_smart_for_overwrite<std::byte[], Count>(size)) {}
+
+    explicit shared_buffer(smart_ptr<std::byte[], Count> bytes) noexcept :
+    bytes_(std::move(bytes)) {}
+
+    static shared_buffer copy_of(const void* data, std::size_t size) {
+        shared_buffer buffer(size);
+        if (size) std::memcpy(buffer.data(), data, size);
+        return buffer;
+    }
+
+    std::byte* data() const noexcept {
+        return bytes_.try_get();
+    }
+
+    std::size_t size() const noexcept {
+        return bytes_.size();
+    }
+
+    bool empty() const noexcept {
+        return bytes_.size() == 0;
+    }
+
+    std::span<std::byte> bytes() const noexcept {
+        return { data(), size() };
+    }
+
+    // Bytes [offset, offset + length) of this buffer, sharing its block.
+    // Throws std::out_of_range if the range does not fit.
+    shared_buffer slice(std::size_t offset, std::size_t length) const {
+        if (offset > size() || length > size() - offset) throw std::out_of_range("shared_buffer::slice");
+        return shared_buffer(smart_ptr<std::byte[], Count>(bytes_, data() + offset, length));
+    }
+
+    // Everything from offset to the end.
+    shared_buffer slice(std::size_t offset) const {
+        if (offset > size()) throw std::out_of_range("shared_buffer::slice");
+        return slice(offset, size() - offset);
+    }
+
+    // Number of buffers and slices sharing the block.
+    int ref_count() const noexcept {
+        return bytes_.ref_count();
+    }
+
+private:
+    smart_ptr<std::byte[], Count> bytes_;   // this buffer's range, owning the whole block
+};
+
+// A sequence of buffers, possibly slices of different blocks, treated as
+// one message for scatter/gather I/O.
+template <typename Count = single_threaded>
+class buffer_chain {
+public:
+    void append(shared_buffer<Count> buffer) {
+        if (buffer.empty()) return;
+        size_ += buffer.size();
+        buffers_.push_back(std::move(buffer));
+    }
+
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    const std::vector<shared_buffer<Count>>& buffers() const noexcept {
+        return buffers_;
+    }
+
+    // Drops the first n bytes, e.g. after a partial write.
+    void consume(std::size_t n) {
+        if (n > size_) throw std::out_of_range("buffer_chain::consume");
+        size_ -= n;
+        std::size_t whole = 0;
+        while (whole < buffers_.size() && n >= buffers_[whole].size()) n -= buffers_[whole++].size();
+        buffers_.erase(buffers_.begin(), buffers_.begin() + whole);
+        if (n) buffers_.front() = buffers_.front().slice(n);
+    }
+
+#if __has_include(<sys/uio.h>)
+    // Writes as much of the chain as one writev() takes and consumes it.
+    // Returns writev()'s result.
+    ssize_t write_to(int fd) {
+        std::vector<iovec> io = iovecs();
+        ssize_t written = ::writev(fd, io.data(), static_cast<int>(io.size()));
+        if (written > 0) consume(static_cast<std::size_t>(written));
+        return written;
+    }
+
+    // Fills the chain's buffers, in order, with one readv(). Returns
+    // readv()'s result.
+    ssize_t read_from(int fd) const {
+        std::vector<iovec> io = iovecs();
+        return ::readv(fd, io.data(), static_cast<int>(io.size()));
+    }
+
+    // One entry per buffer, at most IOV_MAX of them.
+    std::vector<iovec> iovecs() const {
+        std::vector<iovec> io;
+        io.reserve(std::min<std::size_t>(buffers_.size(), IOV_MAX));
+        for (const auto& buffer : buffers_) {
+            if (io.size() == IOV_MAX) break;
+            io.push_back({ buffer.data(), buffer.size() });
+        }
+        return io;
+    }
+#endif
+
+private:
+    std::vector<shared_buffer<Count>> buffers_;
+    std::size_t size_ = 0;     // total bytes
+};
+
+#endif /* shared_buffer_h */
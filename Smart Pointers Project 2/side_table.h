@@ -0,0 +1,313 @@
+#ifndef side_table_h
+#define side_table_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "smart_ptr.h"
+
+#if __has_include(<sys/mman.h>)
+#include <cerrno>
+#include <system_error>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Counting policy that keeps both counts out of the control block, in a
+// dense table of slots mapped separately from everything else. Copying and
+// releasing a smart_ptr then writes only to the table, so objects built
+// before fork() stay on pages the parent and its workers share: each worker
+// dirties a few table pages rather than every page holding an object.
+// Counts are atomic, with the same ordering as multi_threaded.
+//
+// Blocks placed in a frozen_arena are never disposed: once their count
+// reaches zero they are left in place, since running destructors would
+// write to read-only pages. The arena frees the memory wholesale, and
+// hands their slots back to the table when it is destroyed.
+class side_table {
+public:
+    struct slot {
+        std::atomic<int> count;
+        std::atomic<int> weak;
+    };
+
+    struct count_type {
+        slot* s;
+        slot fallback;      // used only if the table cannot grow
+
+        explicit count_type(int n) noexcept :
+        s(acquire()),
+        fallback {} {
+            if (!s) s = &fallback;
+            s->count.store(n, std::memory_order_relaxed);
+            s->weak.store(1, std::memory_order_relaxed);
+        }
+    };
+
+    // The weak count lives in the slot too.
+    struct weak_type {
+        explicit weak_type(int) noexcept {}
+    };
+
+    template <typename Block>
+    static void increment(Block& b) noexcept {
+        std::atomic<int>& count = b.count.s->count;
+        if (count.load(std::memory_order_relaxed) != immortal_count) count.fetch_add(1, std::memory_order_relaxed);
+    }
+    template <typename Block>
+    static bool decrement(Block& b) noexcept {
+        std::atomic<int>& count = b.count.s->count;
+        return count.load(std::memory_order_relaxed) != immortal_count &&
+               count.fetch_sub(1, std::memory_order_acq_rel) == 1 && !retire_frozen(&b, b.count);
+    }
+    template <typename Block>
+    static int load(const Block& b) noexcept {
+        return b.count.s->count.load(std::memory_order_relaxed);
+    }
+
+    template <typename Block>
+    static bool try_increment(Block& b) noexcept {
+        std::atomic<int>& count = b.count.s->count;
+        int n = count.load(std::memory_order_relaxed);
+        do {
+            if (n == 0) return false;
+            if (n == immortal_count) return true;
+        } while (!count.compare_exchange_weak(n, n + 1, std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+        return true;
+    }
+    template <typename Block>
+    static void set_immortal(Block& b) noexcept {
+        b.count.s->count.store(immortal_count, std::memory_order_relaxed);
+    }
+    template <typename Block>
+    static void increment_weak(Block& b) noexcept {
+        b.count.s->weak.fetch_add(1, std::memory_order_relaxed);
+    }
+    // The block is destroyed right after the last weak release, so its slot
+    // goes back to the table here.
+    template <typename Block>
+    static bool decrement_weak(Block& b) noexcept {
+        slot* s = b.count.s;
+        if (s->weak.load(std::memory_order_acquire) != 1 &&
+            s->weak.fetch_sub(1, std::memory_order_acq_rel) != 1) return false;
+        if (s != &b.count.fallback) release(s);
+        return true;
+    }
+
+    // Blocks in [begin, begin + size) are no longer disposed; used by
+    // frozen_arena. thaw_range() returns the slots of those that reached
+    // zero, so no smart_ptr or weak_smart_ptr into the range may outlive it.
+    static void freeze_range(const void* begin, std::size_t size) {
+        table& t = instance();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        auto first = reinterpret_cast<std::uintptr_t>(begin);
+        t.frozen.push_back({ first, first + size, {} });
+        t.frozen_count.fetch_add(1, std::memory_order_release);
+    }
+
+    static void thaw_range(const void* begin) noexcept {
+        table& t = instance();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        auto first = reinterpret_cast<std::uintptr_t>(begin);
+        for (auto& range : t.frozen) {
+            if (range.first != first) continue;
+            for (slot* s : range.retired) release_locked(t, s);
+            range = std::move(t.frozen.back());
+            t.frozen.pop_back();
+            t.frozen_count.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+    }
+
+private:
+    static constexpr std::size_t chunk_bytes = 64 * 1024;
+
+    struct free_slot {
+        free_slot* next;
+    };
+    static_assert(sizeof(free_slot) <= sizeof(slot));
+
+    struct frozen_range {
+        std::uintptr_t first;
+        std::uintptr_t last;
+        std::vector<slot*> retired;  // slots of blocks whose count reached zero
+    };
+
+    struct table {
+        std::mutex mutex;
+        free_slot* free = nullptr;
+        slot* next = nullptr;        // unused part of the newest chunk
+        slot* end = nullptr;
+        std::atomic<int> frozen_count { 0 };
+        std::vector<frozen_range> frozen;
+    };
+
+    // Never destroyed, like block_pool's registry: blocks may be released
+    // during static destruction.
+    static table& instance() noexcept {
+        static table* t = new table;
+        return *t;
+    }
+
+    // nullptr if a new chunk cannot be mapped.
+    static slot* acquire() noexcept {
+        table& t = instance();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        if (free_slot* f = t.free) {
+            t.free = f->next;
+            f->~free_slot();
+            return ::new (static_cast<void*>(f)) slot;
+        }
+        if (t.next == t.end) {
+            void* chunk = map_chunk();
+            if (!chunk) return nullptr;
+            t.next = static_cast<slot*>(chunk);
+            t.end = t.next + chunk_bytes / sizeof(slot);
+        }
+        return ::new (static_cast<void*>(t.next++)) slot;
+    }
+
+    static void release(slot* s) noexcept {
+        table& t = instance();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        release_locked(t, s);
+    }
+
+    static void release_locked(table& t, slot* s) noexcept {
+        s->~slot();
+        t.free = ::new (static_cast<void*>(s)) free_slot { t.free };
+    }
+
+    static void* map_chunk() noexcept {
+#if __has_include(<sys/mman.h>)
+        void* p = ::mmap(nullptr, chunk_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? nullptr : p;
+#else
+        return ::operator new(chunk_bytes, std::nothrow);
+#endif
+    }
+
+    // Checked only when a count reaches zero. A frozen block's slot is kept
+    // for thaw_range(); if recording it fails, the slot is leaked.
+    static bool retire_frozen(const void* block, count_type& c) noexcept {
+        table& t = instance();
+        if (t.frozen_count.load(std::memory_order_acquire) == 0) return false;
+        auto p = reinterpret_cast<std::uintptr_t>(block);
+        std::lock_guard<std::mutex> lock(t.mutex);
+        for (auto& range : t.frozen) {
+            if (p < range.first || p >= range.last) continue;
+            if (c.s != &c.fallback) {
+                try {
+                    range.retired.push_back(c.s);
+                } catch (...) {}
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+#if __has_include(<sys/mman.h>)
+// Bump allocator over one private mapping that freeze() makes read-only.
+// Build a graph in it with allocate_smart<T, side_table>(arena_allocator<T>(arena)),
+// freeze it, then fork: neither the parent nor the workers can write to
+// those pages again, so they stay shared. Not thread-safe while building.
+//
+// Objects released before freeze() are destroyed but their memory is not
+// reused. Objects still in the arena when it is destroyed are not
+// destroyed at all, so every smart_ptr and weak_smart_ptr into it must be
+// gone by then.
+class frozen_arena {
+public:
+    // Reserves capacity bytes; pages are committed as they are used.
+    explicit frozen_arena(std::size_t capacity) :
+    capacity_((capacity + page() - 1) & ~(page() - 1)) {
+        void* p = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "frozen_arena: mmap");
+        base_ = static_cast<std::byte*>(p);
+    }
+
+    frozen_arena(const frozen_arena&) = delete;
+    frozen_arena& operator=(const frozen_arena&) = delete;
+
+    ~frozen_arena() {
+        if (frozen_) side_table::thaw_range(base_);
+        ::munmap(base_, capacity_);
+    }
+
+    // Throws std::bad_alloc once the arena is full or frozen.
+    void* allocate(std::size_t bytes, std::size_t align) {
+        std::size_t start = (used_ + align - 1) & ~(align - 1);
+        if (frozen_ || start > capacity_ || bytes > capacity_ - start) throw std::bad_alloc();
+        used_ = start + bytes;
+        return base_ + start;
+    }
+
+    // Makes everything allocated so far read-only. Any later write to it,
+    // including a count update under a policy other than side_table, faults.
+    void freeze() {
+        if (frozen_) return;
+        side_table::freeze_range(base_, capacity_);
+        frozen_ = true;
+        if (::mprotect(base_, capacity_, PROT_READ) != 0)
+            throw std::system_error(errno, std::generic_category(), "frozen_arena: mprotect");
+    }
+
+    bool frozen() const noexcept {
+        return frozen_;
+    }
+
+    std::size_t used() const noexcept {
+        return used_;
+    }
+
+private:
+    std::byte* base_;
+    std::size_t capacity_;
+    std::size_t used_ = 0;
+    bool frozen_ = false;
+
+    static std::size_t page() noexcept {
+        return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    }
+};
+
+// Allocator for allocate_smart() that places blocks in a frozen_arena.
+// deallocate() does nothing; the arena frees everything at once.
+template <typename T>
+class arena_allocator {
+public:
+    using value_type = T;
+
+    explicit arena_allocator(frozen_arena& arena) noexcept :
+    arena_(&arena) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other) noexcept :
+    arena_(other.arena_) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept {}
+
+    template <typename U>
+    bool operator==(const arena_allocator<U>& other) const noexcept {
+        return arena_ == other.arena_;
+    }
+
+private:
+    template <typename U>
+    friend class arena_allocator;
+
+    frozen_arena* arena_;
+};
+#endif
+
+#endif /* side_table_h */
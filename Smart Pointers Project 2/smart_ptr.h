@@ -0,0 +1,1087 @@
+#ifndef smart_ptr_h
+#define smart_ptr_h
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "block_pool.h"
+
+struct null_ptr_exception : public std::exception {
+    const char* what() const noexcept override {
+        return "Attempting to access a null pointer";
+    }
+};
+
+struct sliced_clone_exception : public std::exception {
+    const char* what() const noexcept override {
+        return "Cloning through a converted or aliased pointer would slice the object";
+    }
+};
+
+// Null-check policies for smart_ptr's operator* and operator->. check(p)
+// runs before every dereference; all but throw_on_null are noexcept, so the
+// operators become noexcept too and inline into tight loops.
+
+// Throws null_ptr_exception. The default.
+struct throw_on_null {
+    static void check(const void* p) {
+        if (!p) throw null_ptr_exception();
+    }
+};
+
+// assert() in debug builds, nothing under NDEBUG.
+struct assert_not_null {
+    static void check([[maybe_unused]] const void* p) noexcept {
+        assert(p && "Attempting to access a null pointer");
+    }
+};
+
+// Stops the process on the spot, without unwinding.
+struct trap_on_null {
+    static void check(const void* p) noexcept {
+        if (!p) __builtin_trap();
+    }
+};
+
+// No check; dereferencing an empty smart_ptr is undefined behavior.
+struct unchecked {
+    static void check(const void*) noexcept {}
+};
+
+// Counting policies. Each one names the strong and weak counts stored in
+// the control block and the operations smart_ptr performs on that block.
+// decrement() and decrement_weak() return true when the caller dropped the
+// last reference; try_increment() takes a strong reference only while the
+// object is still alive.
+//
+// A count of immortal_count marks an object frozen by smart_ptr::freeze()
+// or make_immortal(): policies that provide set_immortal() leave such a
+// count untouched, so copies and releases never write to the block.
+inline constexpr int immortal_count = INT_MAX;
+
+// Plain int, for pointers that never leave the thread that created them.
+struct single_threaded {
+    using count_type = int;
+    using weak_type = int;
+
+    template <typename Block>
+    static void increment(Block& b) noexcept {
+        if (b.count != immortal_count) ++b.count;
+    }
+    template <typename Block>
+    static bool decrement(Block& b) noexcept {
+        return b.count != immortal_count && --b.count == 0;
+    }
+    template <typename Block>
+    static int load(const Block& b) noexcept { return b.count; }
+
+    template <typename Block>
+    static bool try_increment(Block& b) noexcept {
+        if (b.count == 0) return false;
+        if (b.count != immortal_count) ++b.count;
+        return true;
+    }
+    template <typename Block>
+    static void set_immortal(Block& b) noexcept { b.count = immortal_count; }
+    template <typename Block>
+    static void increment_weak(Block& b) noexcept { ++b.weak; }
+    template <typename Block>
+    static bool decrement_weak(Block& b) noexcept { return --b.weak == 0; }
+};
+
+// As single_threaded, but a smart_ptr built from a raw pointer or with
+// make_smart() starts out owning its object alone, with no control block:
+// moving and destroying it cost what they do for unique_ptr. The block is
+// allocated when the pointer is first shared, by a copy, an alias, a
+// weak_smart_ptr or smart_ref::to_owned(), and that first copy writes to
+// the source. Borrowing it as a smart_ref does not allocate.
+struct unique_first : single_threaded {
+    static constexpr bool lazy_block = true;
+};
+
+// Atomic count, for pointers shared across threads. Taking another reference
+// needs no ordering because the caller already holds one; the final decrement
+// is acq_rel so every write made through other references happens before the
+// object is destroyed. An immortal count is only ever read, so its cache
+// line stays shared between cores.
+struct multi_threaded {
+    using count_type = std::atomic<int>;
+    using weak_type = std::atomic<int>;
+
+    template <typename Block>
+    static void increment(Block& b) noexcept {
+        if (b.count.load(std::memory_order_relaxed) != immortal_count)
+            b.count.fetch_add(1, std::memory_order_relaxed);
+    }
+    template <typename Block>
+    static bool decrement(Block& b) noexcept {
+        return b.count.load(std::memory_order_relaxed) != immortal_count &&
+               b.count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    template <typename Block>
+    static int load(const Block& b) noexcept {
+        return b.count.load(std::memory_order_relaxed);
+    }
+
+    template <typename Block>
+    static bool try_increment(Block& b) noexcept {
+        int n = b.count.load(std::memory_order_relaxed);
+        do {
+            if (n == 0) return false;
+            if (n == immortal_count) return true;
+        } while (!b.count.compare_exchange_weak(n, n + 1, std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed));
+        return true;
+    }
+    template <typename Block>
+    static void set_immortal(Block& b) noexcept {
+        b.count.store(immortal_count, std::memory_order_relaxed);
+    }
+    template <typename Block>
+    static void increment_weak(Block& b) noexcept {
+        b.weak.fetch_add(1, std::memory_order_relaxed);
+    }
+    // A weak count of one means the caller holds the only weak reference and
+    // nobody can take another, so the locked decrement can be skipped.
+    template <typename Block>
+    static bool decrement_weak(Block& b) noexcept {
+        return b.weak.load(std::memory_order_acquire) == 1 ||
+               b.weak.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+template <typename Count>
+struct ctrl_block;
+
+// Biased counting: the thread that creates the object counts its own
+// references without locked instructions, every other thread goes through
+// an atomic shared count. The owner merges the two once its own references
+// are gone, and only a merged block can be destroyed.
+//
+// A reference copied on the owner and dropped elsewhere drives the shared
+// count negative. That thread then queues the block for its owner, which
+// merges it in merge_pending(), on its next merge, or when it exits. Owners
+// that keep objects alive for long periods should call merge_pending() at
+// quiet points so such blocks are reclaimed promptly.
+class biased {
+public:
+    using weak_type = std::atomic<int>;
+
+    struct count_type {
+        std::uint64_t owner;            // id of the creating thread
+        std::atomic<int> biased;        // owner's references; written by the owner only
+        bool merged;                    // owner has folded biased into shared
+        std::atomic<int> shared;        // other threads' references << 2 | flags
+
+        explicit count_type(int n) noexcept :
+        owner(this_thread().id),
+        biased(n),
+        merged(false),
+        shared(0) {}
+    };
+
+    template <typename Block>
+    static void increment(Block& b) noexcept {
+        count_type& c = b.count;
+        if (c.owner == current_ && !c.merged) {
+            c.biased.store(c.biased.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            c.shared.fetch_add(one, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename Block>
+    static bool decrement(Block& b) noexcept {
+        count_type& c = b.count;
+        if (c.owner == current_ && !c.merged) {
+            int n = c.biased.load(std::memory_order_relaxed) - 1;
+            c.biased.store(n, std::memory_order_relaxed);
+            if (n > 0) return false;
+            bool last = merge(c);
+            merge_pending();
+            return last;
+        }
+
+        int old = c.shared.load(std::memory_order_relaxed), next;
+        do {
+            next = old - one;
+            if (!(old & merged_flag) && !(old & queued_flag) && (next >> 2) < 0) next |= queued_flag;
+        } while (!c.shared.compare_exchange_weak(old, next, std::memory_order_acq_rel));
+
+        if (old & merged_flag) return (next >> 2) == 0 && !(next & queued_flag);
+        if (next & queued_flag && !(old & queued_flag)) return enqueue(b);
+        return false;
+    }
+
+    template <typename Block>
+    static int load(const Block& b) noexcept {
+        const count_type& c = b.count;
+        int shared = c.shared.load(std::memory_order_relaxed);
+        if (shared & merged_flag) return shared >> 2;
+        return (shared >> 2) + c.biased.load(std::memory_order_relaxed);
+    }
+
+    // Fails once both counts add up to zero, even on an unmerged block
+    // that is still waiting in its owner's queue, so that lock() agrees
+    // with load(). The owner's check is exact; other threads read the
+    // biased count without synchronizing, but it can only be changed by
+    // an owner that holds a reference.
+    template <typename Block>
+    static bool try_increment(Block& b) noexcept {
+        count_type& c = b.count;
+        if (c.owner == current_ && !c.merged) {
+            int n = c.biased.load(std::memory_order_relaxed);
+            if (n + (c.shared.load(std::memory_order_acquire) >> 2) == 0) return false;
+            c.biased.store(n + 1, std::memory_order_relaxed);
+            return true;
+        }
+        int old = c.shared.load(std::memory_order_relaxed);
+        do {
+            int owned = (old & merged_flag) ? 0 : c.biased.load(std::memory_order_relaxed);
+            if (owned + (old >> 2) == 0) return false;
+        } while (!c.shared.compare_exchange_weak(old, old + one, std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed));
+        return true;
+    }
+    template <typename Block>
+    static void increment_weak(Block& b) noexcept { multi_threaded::increment_weak(b); }
+    template <typename Block>
+    static bool decrement_weak(Block& b) noexcept { return multi_threaded::decrement_weak(b); }
+
+    // Merges every block other threads have queued for the calling thread.
+    static void merge_pending() noexcept;
+
+private:
+    static constexpr int merged_flag = 1;
+    static constexpr int queued_flag = 2;
+    static constexpr int one = 4;
+
+    struct thread_state {
+        std::uint64_t id;
+        std::vector<ctrl_block<biased>*> queue;    // guarded by the registry's mutex
+        std::atomic<bool> pending { false };
+
+        thread_state();
+        ~thread_state();
+    };
+
+    static inline std::atomic<std::uint64_t> next_id_ { 1 };
+    static inline thread_local std::uint64_t current_ = 0;
+
+    struct registry {
+        std::mutex mutex;
+        std::unordered_map<std::uint64_t, thread_state*> threads;
+    };
+
+    // Never destroyed, like block_pool's: threads that exit after static
+    // destruction still unregister themselves.
+    static registry& threads() {
+        static registry* r = new registry;
+        return *r;
+    }
+
+    static thread_state& this_thread() {
+        static thread_local thread_state state;
+        return state;
+    }
+
+    // Folds the owner's references into the shared count. Returns true if
+    // that left no references and nobody else is responsible for the block.
+    static bool merge(count_type& c) noexcept {
+        int add = c.biased.load(std::memory_order_relaxed) * one + merged_flag;
+        c.biased.store(0, std::memory_order_relaxed);
+        c.merged = true;
+        int old = c.shared.fetch_add(add, std::memory_order_acq_rel);
+        return ((old + add) >> 2) == 0 && !(old & queued_flag);
+    }
+
+    // Called by the thread that set queued_flag; the flag keeps the block
+    // alive until whoever drains the queue clears it.
+    static bool enqueue(ctrl_block<biased>& b) noexcept;
+    static bool unqueue(ctrl_block<biased>& b) noexcept;
+};
+
+// Shared by every smart_ptr and weak_smart_ptr that refers to the same
+// object. The object is disposed of when the strong count drops to zero;
+// the block itself lives until the weak count does too. All strong
+// references together hold one weak reference.
+template <typename Count>
+struct ctrl_block {
+    typename Count::count_type count;   // number of smart_ptrs sharing the object
+    typename Count::weak_type weak;     // number of weak_smart_ptrs, plus one
+
+    explicit ctrl_block(int n) noexcept : count(n), weak(1) {}
+    virtual void dispose() noexcept = 0;    // destroys the object
+    virtual void destroy() noexcept = 0;    // frees the block
+
+    // True if the block owns an object of exactly type t at p, that is if
+    // a smart_ptr to p was neither converted to a base nor aliased.
+    virtual bool holds(const void* p, const std::type_info& t) const noexcept = 0;
+
+    // Called once the last strong reference is gone.
+    void expire() noexcept {
+        dispose();
+        release_weak();
+    }
+
+    void release_weak() noexcept {
+        if (Count::decrement_weak(*this)) destroy();
+    }
+
+protected:
+    ~ctrl_block() = default;
+};
+
+inline biased::thread_state::thread_state() : id(next_id_.fetch_add(1, std::memory_order_relaxed)) {
+    registry& r = threads();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.emplace(id, this);
+    current_ = id;
+}
+
+inline biased::thread_state::~thread_state() {
+    std::vector<ctrl_block<biased>*> blocks;
+    {
+        registry& r = threads();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.threads.erase(id);
+        blocks.swap(queue);
+    }
+    // Anything this thread still releases now takes the shared path.
+    current_ = 0;
+    for (auto* block : blocks) {
+        if (!block->count.merged) merge(block->count);
+        if (unqueue(*block)) block->expire();
+    }
+}
+
+inline void biased::merge_pending() noexcept {
+    thread_state& self = this_thread();
+    if (!self.pending.load(std::memory_order_acquire)) return;
+
+    std::vector<ctrl_block<biased>*> blocks;
+    {
+        std::lock_guard<std::mutex> lock(threads().mutex);
+        blocks.swap(self.queue);
+        self.pending.store(false, std::memory_order_relaxed);
+    }
+    for (auto* block : blocks) {
+        if (!block->count.merged) merge(block->count);
+        if (unqueue(*block)) block->expire();
+    }
+}
+
+inline bool biased::enqueue(ctrl_block<biased>& b) noexcept {
+    registry& r = threads();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto owner = r.threads.find(b.count.owner);
+    if (owner != r.threads.end()) {
+        owner->second->queue.push_back(&b);
+        owner->second->pending.store(true, std::memory_order_release);
+        return false;
+    }
+    // The owner has exited, so its biased count can no longer change and
+    // the registry lock orders its last write before this merge.
+    if (!b.count.merged) merge(b.count);
+    return unqueue(b);
+}
+
+// Clears queued_flag on a merged block; true if it was the last reference.
+inline bool biased::unqueue(ctrl_block<biased>& b) noexcept {
+    int old = b.count.shared.fetch_and(~queued_flag, std::memory_order_acq_rel);
+    return (old >> 2) == 0;
+}
+
+// Opt-in iterative teardown, for objects that own the next one through a
+// smart_ptr (linked lists, deep trees). Releasing the head of such a chain
+// normally recurses once per node. With
+//     struct Node;
+//     template <> inline constexpr bool iterative_teardown<Node> = true;
+//     struct Node { smart_ptr<Node> next; };
+// a Node whose last reference goes away while another teardown is running
+// on the same thread is queued instead, and the outermost release drains
+// the queue, so the stack depth stays constant. The specialization must
+// come before Node's definition, whose smart_ptr members already use it.
+template <typename T>
+inline constexpr bool iterative_teardown = false;
+
+class teardown_queue {
+public:
+    template <typename Count>
+    static void expire(ctrl_block<Count>* block) noexcept {
+        state& s = local();
+        if (s.draining) {
+            try {
+                s.pending.push_back({ block, &run<Count> });
+                return;
+            } catch (...) {
+                // Out of memory for the queue: fall back to recursing.
+                block->expire();
+                return;
+            }
+        }
+        s.draining = true;
+        block->expire();
+        while (!s.pending.empty()) {
+            entry e = s.pending.back();
+            s.pending.pop_back();
+            e.run(e.block);
+        }
+        s.draining = false;
+    }
+
+private:
+    struct entry {
+        void* block;
+        void (*run)(void*) noexcept;
+    };
+
+    struct state {
+        bool draining = false;
+        std::vector<entry> pending;
+    };
+
+    static state& local() noexcept {
+        static thread_local state s;
+        return s;
+    }
+
+    template <typename Count>
+    static void run(void* block) noexcept {
+        static_cast<ctrl_block<Count>*>(block)->expire();
+    }
+};
+
+// Control blocks are allocated through an allocator rebound to the block
+// type, so that allocate_smart() and the deleter constructors can place them
+// in the caller's memory. With std::allocator this is plain new and delete.
+template <typename Block, typename Alloc, typename... Args>
+Block* new_block(const Alloc& alloc, Args&&... args) {
+    using block_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Block>;
+    using traits = std::allocator_traits<block_alloc>;
+    block_alloc a(alloc);
+    Block* b = traits::allocate(a, 1);
+    try {
+        ::new (static_cast<void*>(b)) Block(std::forward<Args>(args)...);
+    } catch (...) {
+        traits::deallocate(a, b, 1);
+        throw;
+    }
+    return b;
+}
+
+template <typename Block, typename Alloc>
+void delete_block(Block* b, const Alloc& alloc) noexcept {
+    using block_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Block>;
+    block_alloc a(alloc);
+    b->~Block();
+    std::allocator_traits<block_alloc>::deallocate(a, b, 1);
+}
+
+// Block for an object the caller allocated separately: two allocations.
+// Empty deleters and allocators take no space.
+template <typename T, typename Count, typename Deleter = std::default_delete<T>,
+          typename Alloc = std::allocator<T>>
+struct ptr_block final : ctrl_block<Count> {
+    T* ptr;
+    [[no_unique_address]] Deleter deleter;
+    [[no_unique_address]] Alloc alloc;
+
+    ptr_block(T* p, Deleter d, const Alloc& a) noexcept :
+    ctrl_block<Count>(1),
+    ptr(p),
+    deleter(std::move(d)),
+    alloc(a) {}
+
+    void dispose() noexcept override { deleter(ptr); }
+    void destroy() noexcept override { delete_block(this, alloc); }
+    bool holds(const void* p, const std::type_info& t) const noexcept override {
+        return p == ptr && t == typeid(T);
+    }
+};
+
+// Block that stores the object right after the count: one allocation. The
+// object's own memory is therefore returned only with the block. A const
+// T is built and destroyed through an allocator of the unqualified type.
+template <typename T, typename Count, typename Alloc = std::allocator<std::remove_cv_t<T>>>
+struct inplace_block final : ctrl_block<Count> {
+    using value_type = std::remove_cv_t<T>;
+    using value_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<value_type>;
+
+    [[no_unique_address]] value_alloc alloc;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    template <typename... Args>
+    explicit inplace_block(const Alloc& a, Args&&... args) :
+    ctrl_block<Count>(1),
+    alloc(a) {
+        std::allocator_traits<value_alloc>::construct(alloc, reinterpret_cast<value_type*>(storage),
+                                                      std::forward<Args>(args)...);
+    }
+
+    T* get() noexcept {
+        return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    void dispose() noexcept override {
+        std::allocator_traits<value_alloc>::destroy(alloc, std::launder(reinterpret_cast<value_type*>(storage)));
+    }
+    void destroy() noexcept override { delete_block(this, alloc); }
+    bool holds(const void* p, const std::type_info& t) const noexcept override {
+        return p == storage && t == typeid(T);
+    }
+};
+
+template <typename T, typename Count, typename Check>
+class weak_smart_ptr;
+
+template <typename T>
+class atomic_smart_ptr;
+
+template <typename T, typename Count, typename Check, bool Watched>
+class smart_ref;
+
+// Element count of a smart_ptr<T[]>; smart_ptr<T> stores no_extent, which
+// takes no room.
+struct no_extent {};
+
+// Control block followed by the elements of an array in one allocation,
+// the first element aligned to at least align bytes. Over-alignment is had
+// by allocating up to align - 1 spare bytes from plain operator new, which
+// is much cheaper than the aligned overload with most allocators.
+template <typename E, typename Count>
+struct array_block final : ctrl_block<Count> {
+    E* data;
+    std::size_t size;
+
+    // Elements are value-initialized, or default-initialized (left
+    // indeterminate for trivial types) when for_overwrite is set.
+    static array_block* create(std::size_t n, std::size_t align, bool for_overwrite) {
+        static_assert(alignof(array_block) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        assert((align & (align - 1)) == 0 && "alignment must be a power of two");
+        align = std::max(align, alignof(E));
+        std::size_t spare = sizeof(array_block) + align - 1;
+        if (n > (SIZE_MAX - spare) / sizeof(E)) throw std::bad_array_new_length();
+        void* memory = ::operator new(spare + n * sizeof(E));
+        auto first = reinterpret_cast<std::uintptr_t>(memory) + sizeof(array_block);
+        E* data = reinterpret_cast<E*>((first + align - 1) & ~(std::uintptr_t(align) - 1));
+        try {
+            if (for_overwrite) std::uninitialized_default_construct_n(data, n);
+            else std::uninitialized_value_construct_n(data, n);
+        } catch (...) {
+            ::operator delete(memory);
+            throw;
+        }
+        return ::new (memory) array_block(data, n);
+    }
+
+    void dispose() noexcept override { std::destroy_n(data, size); }
+
+    void destroy() noexcept override {
+        this->~array_block();
+        ::operator delete(static_cast<void*>(this));
+    }
+
+    bool holds(const void* p, const std::type_info& t) const noexcept override {
+        return p == data && t == typeid(E);
+    }
+
+private:
+    array_block(E* d, std::size_t n) noexcept :
+    ctrl_block<Count>(1),
+    data(d),
+    size(n) {}
+};
+
+// An empty or moved-from smart_ptr has no control block and owns no heap
+// memory; only the raw-pointer constructors and clone() allocate, or under
+// unique_first the first copy of a sole owner. Check decides what
+// operator* and operator-> do on an empty pointer. smart_ptrs to derived
+// classes, or that differ only in Check, convert implicitly and share
+// ownership; clone() refuses to copy through such a conversion.
+//
+// smart_ptr<T[]> owns an array: it has operator[] and size() instead of
+// operator* and operator->, and releases with delete[] or its deleter.
+template <typename T, typename Count = single_threaded, typename Check = throw_on_null>
+class smart_ptr {
+    static constexpr bool is_array = std::is_array_v<T>;
+    static constexpr bool lazy = requires { requires Count::lazy_block; };
+    using extent_type = std::conditional_t<is_array, std::size_t, no_extent>;
+
+public:
+    using element_type = std::remove_extent_t<T>;
+
+    smart_ptr() noexcept :
+    ptr_(nullptr),
+    ref_(nullptr) {}
+
+    // If the control block cannot be allocated, raw_ptr is deleted and
+    // std::bad_alloc propagates.
+    explicit smart_ptr(T* &raw_ptr) requires (!is_array) :
+    ptr_(raw_ptr),
+    ref_(own(raw_ptr)) {}
+
+    explicit smart_ptr(T* &&raw_ptr) requires (!is_array) :
+    ptr_(raw_ptr),
+    ref_(own(raw_ptr)) {
+        raw_ptr = nullptr;
+    }
+
+    // Releases the object with deleter(raw_ptr) instead of delete, and
+    // allocates the control block from alloc. On failure deleter(raw_ptr)
+    // is called before std::bad_alloc propagates.
+    template <typename Deleter, typename Alloc = pool_allocator<element_type>>
+        requires (!is_array && std::is_invocable_v<Deleter&, T*>)
+    smart_ptr(T* raw_ptr, Deleter deleter, const Alloc& alloc = Alloc()) :
+    ptr_(raw_ptr),
+    ref_(adopt(raw_ptr, std::move(deleter), alloc)) {}
+
+    // Takes an array of n elements from new[]; released with delete[].
+    smart_ptr(element_type* raw_ptr, std::size_t n) requires is_array :
+    ptr_(raw_ptr),
+    ref_(own(raw_ptr)),
+    size_(raw_ptr ? n : 0) {}
+
+    template <typename Deleter, typename Alloc = pool_allocator<element_type>>
+        requires (is_array && std::is_invocable_v<Deleter&, element_type*>)
+    smart_ptr(element_type* raw_ptr, std::size_t n, Deleter deleter, const Alloc& alloc = Alloc()) :
+    ptr_(raw_ptr),
+    ref_(adopt(raw_ptr, std::move(deleter), alloc)),
+    size_(raw_ptr ? n : 0) {}
+
+    smart_ptr(const smart_ptr& rhs) noexcept(!lazy) :
+    ptr_(rhs.ptr_),
+    ref_(rhs.share()),
+    size_(rhs.size_) {
+        if (ref_) Count::increment(*ref_);
+    }
+
+    smart_ptr(smart_ptr&& rhs) noexcept :
+    ptr_(rhs.ptr_),
+    ref_(rhs.ref_),
+    size_(rhs.size_) {
+        rhs.ptr_ = nullptr;
+        rhs.ref_ = nullptr;
+        rhs.size_ = extent_type();
+    }
+
+    // From a smart_ptr to a derived class, or one that differs only in Check.
+    template <typename U, typename OtherCheck>
+        requires std::is_convertible_v<U*, T*>
+    smart_ptr(const smart_ptr<U, Count, OtherCheck>& rhs) noexcept(!lazy) :
+    ptr_(rhs.ptr_),
+    ref_(rhs.share()),
+    size_(rhs.size_) {
+        if (ref_) Count::increment(*ref_);
+    }
+
+    template <typename U, typename OtherCheck>
+        requires std::is_convertible_v<U*, T*>
+    smart_ptr(smart_ptr<U, Count, OtherCheck>&& rhs) noexcept(!lazy || std::is_same_v<U, T>) :
+    ptr_(rhs.ptr_),
+    ref_(std::is_same_v<U, T> ? rhs.ref_ : rhs.share()),   // a sole owner deletes through its own type
+    size_(rhs.size_) {
+        rhs.ptr_ = nullptr;
+        rhs.ref_ = nullptr;
+        rhs.size_ = extent_type();
+    }
+
+    // Aliasing: shares ownership with owner but points at ptr, typically a
+    // member or base of the owned object, which stays alive as long as this
+    // smart_ptr does. Costs one count increment and no allocation.
+    template <typename U, typename OtherCheck>
+        requires (!is_array)
+    smart_ptr(const smart_ptr<U, Count, OtherCheck>& owner, T* ptr) noexcept(!lazy) :
+    ptr_(ptr),
+    ref_(owner.share()) {
+        if (ref_) Count::increment(*ref_);
+    }
+
+    template <typename U, typename OtherCheck>
+        requires (!is_array)
+    smart_ptr(smart_ptr<U, Count, OtherCheck>&& owner, T* ptr) noexcept(!lazy) :
+    ptr_(ptr),
+    ref_(owner.share()) {
+        owner.ptr_ = nullptr;
+        owner.ref_ = nullptr;
+        owner.size_ = {};
+    }
+
+    // Aliasing for arrays: n elements starting at ptr, kept alive by owner.
+    template <typename U, typename OtherCheck>
+        requires is_array
+    smart_ptr(const smart_ptr<U, Count, OtherCheck>& owner, element_type* ptr, std::size_t n) noexcept(!lazy) :
+    ptr_(ptr),
+    ref_(owner.share()),
+    size_(n) {
+        if (ref_) Count::increment(*ref_);
+    }
+
+    // rhs is read before the old object is released, since it may live
+    // inside that object, as in head = head->next.
+    smart_ptr& operator=(const smart_ptr& rhs) noexcept(!lazy) {
+        if (this != &rhs) {
+            ctrl_block<Count>* ref = rhs.share();
+            element_type* ptr = rhs.ptr_;
+            extent_type size = rhs.size_;
+            if (ref) Count::increment(*ref);
+            release();
+            ptr_ = ptr;
+            ref_ = ref;
+            size_ = size;
+        }
+        return *this;
+    }
+
+    smart_ptr& operator=(smart_ptr&& rhs) noexcept {
+        if (this != &rhs) {
+            element_type* ptr = rhs.ptr_;
+            ctrl_block<Count>* ref = rhs.ref_;
+            extent_type size = rhs.size_;
+            rhs.ptr_ = nullptr;
+            rhs.ref_ = nullptr;
+            rhs.size_ = extent_type();
+            release();
+            ptr_ = ptr;
+            ref_ = ref;
+            size_ = size;
+        }
+        return *this;
+    }
+
+    template <typename U, typename OtherCheck>
+        requires std::is_convertible_v<U*, T*>
+    smart_ptr& operator=(const smart_ptr<U, Count, OtherCheck>& rhs) noexcept(!lazy) {
+        return *this = smart_ptr(rhs);
+    }
+
+    template <typename U, typename OtherCheck>
+        requires std::is_convertible_v<U*, T*>
+    smart_ptr& operator=(smart_ptr<U, Count, OtherCheck>&& rhs) noexcept(!lazy || std::is_same_v<U, T>) {
+        return *this = smart_ptr(std::move(rhs));
+    }
+
+    // Copies the object by its static type T, so a shared object reached
+    // through a conversion to a base class, or an alias, cannot be cloned:
+    // that throws sliced_clone_exception instead of slicing.
+    bool clone() requires (!is_array) {
+        if (!ptr_ || is_unique() || Count::load(*ref_) == 1) return false;
+        if (typeid(*ptr_) != typeid(T) || !ref_->holds(ptr_, typeid(T))) throw sliced_clone_exception();
+        using value_alloc = pool_allocator<std::remove_cv_t<T>>;
+        auto* block = new_block<inplace_block<T, Count, value_alloc>>(value_alloc(), value_alloc(), *ptr_);
+        if (Count::decrement(*ref_)) expire(ref_);
+        ptr_ = block->get();
+        ref_ = block;
+        return true;
+    }
+
+    // immortal_count once frozen.
+    int ref_count() const noexcept {
+        if (is_unique()) return 1;
+        return ref_ ? Count::load(*ref_) : 0;
+    }
+
+    // Makes the object immortal: copies and releases stop touching its
+    // count and it is never destroyed, so leak checkers will report it.
+    // Call it before the pointer is shared with other threads. Not
+    // available under biased counting.
+    void freeze() noexcept(!lazy) requires requires (ctrl_block<Count>& b) { Count::set_immortal(b); } {
+        if (share()) Count::set_immortal(*ref_);
+    }
+
+    T& operator*() const noexcept(noexcept(Check::check(ptr_))) requires (!is_array) {
+        Check::check(ptr_);
+        return *ptr_;
+    }
+
+    T* operator->() const noexcept(noexcept(Check::check(ptr_))) requires (!is_array) {
+        Check::check(ptr_);
+        return ptr_;
+    }
+
+    // Unchecked, like indexing a raw pointer.
+    element_type& operator[](std::size_t i) const noexcept requires is_array {
+        return ptr_[i];
+    }
+
+    std::size_t size() const noexcept requires is_array {
+        return size_;
+    }
+
+    // The object, or nullptr if empty; never checks or throws.
+    element_type* try_get() const noexcept {
+        return ptr_;
+    }
+
+    ~smart_ptr() {
+        release();
+    }
+
+private:
+    element_type* ptr_;                // pointer to the referred object
+    mutable ctrl_block<Count>* ref_;   // pointer to the block holding the reference count; see share()
+    [[no_unique_address]] extent_type size_ {};   // number of elements, arrays only
+
+    // Adopts a reference the caller already holds on ref.
+    smart_ptr(ctrl_block<Count>* ref, element_type* ptr, extent_type size = extent_type()) noexcept :
+    ptr_(ptr),
+    ref_(ref),
+    size_(size) {}
+
+    template <typename U, typename C, typename A, typename... Args>
+    friend smart_ptr<U, C> allocate_smart(const A& alloc, Args&&... args);
+    template <typename U, typename C>
+    friend smart_ptr<U, C> allocate_array(std::size_t n, std::size_t align, bool for_overwrite);
+    template <typename U, typename C, typename K>
+    friend class smart_ptr;
+    template <typename U, typename C, typename K>
+    friend class weak_smart_ptr;
+    friend class atomic_smart_ptr<T>;
+    template <typename U, typename C, typename K, bool W>
+    friend class smart_ref;
+
+    template <typename Deleter = std::default_delete<T>, typename Alloc = pool_allocator<element_type>>
+    static ctrl_block<Count>* adopt(element_type* raw_ptr, Deleter deleter = Deleter(), const Alloc& alloc = Alloc()) {
+        if (!raw_ptr) return nullptr;
+        try {
+            return new_block<ptr_block<element_type, Count, Deleter, Alloc>>(alloc, raw_ptr, std::move(deleter), alloc);
+        } catch (...) {
+            deleter(raw_ptr);
+            throw;
+        }
+    }
+
+    // Under unique_first a pointer that owns its object alone has this
+    // instead of a block; it is never dereferenced.
+    static ctrl_block<Count>* unique() noexcept {
+        return reinterpret_cast<ctrl_block<Count>*>(std::uintptr_t(1));
+    }
+
+    bool is_unique() const noexcept {
+        if constexpr (lazy) return ref_ == unique();
+        else return false;
+    }
+
+    // Block for an object released with delete or delete[]; none yet under
+    // unique_first.
+    static ctrl_block<Count>* own(element_type* raw_ptr) {
+        if constexpr (lazy) return raw_ptr ? unique() : nullptr;
+        else return adopt(raw_ptr);
+    }
+
+    // Allocates the block of a sole owner that is about to be shared, and
+    // returns the block. If that fails the pointer is left as it was.
+    ctrl_block<Count>* share() const noexcept(!lazy) {
+        if (is_unique()) {
+            using block = ptr_block<element_type, Count, std::default_delete<T>, pool_allocator<element_type>>;
+            ref_ = new_block<block>(pool_allocator<element_type>(), ptr_, std::default_delete<T>(),
+                                    pool_allocator<element_type>());
+        }
+        return ref_;
+    }
+
+    static void expire(ctrl_block<Count>* ref) noexcept {
+        if constexpr (iterative_teardown<T>) teardown_queue::expire(ref);
+        else ref->expire();
+    }
+
+    void release() noexcept {
+        static_assert(!(lazy && iterative_teardown<T>), "unique_first does not support iterative_teardown");
+        if (is_unique()) {
+            std::default_delete<T>()(ptr_);
+        } else if (ref_ && Count::decrement(*ref_)) {
+            expire(ref_);
+        }
+        ptr_ = nullptr;
+        ref_ = nullptr;
+        size_ = extent_type();
+    }
+};
+
+// Builds the object and its reference count in a single allocation taken
+// from alloc, which also constructs and destroys the object.
+template <typename T, typename Count = single_threaded, typename Alloc, typename... Args>
+smart_ptr<T, Count> allocate_smart(const Alloc& alloc, Args&&... args) {
+    auto* block = new_block<inplace_block<T, Count, Alloc>>(alloc, alloc, std::forward<Args>(args)...);
+    return smart_ptr<T, Count>(block, block->get());
+}
+
+template <typename T, typename Count>
+smart_ptr<T, Count> allocate_array(std::size_t n, std::size_t align, bool for_overwrite) {
+    auto* block = array_block<std::remove_extent_t<T>, Count>::create(n, align, for_overwrite);
+    return smart_ptr<T, Count>(block, block->data, n);
+}
+
+// Builds the object and its reference count in a single allocation; under
+// unique_first, only the object, as make_unique() would.
+template <typename T, typename Count = single_threaded, typename... Args>
+    requires (!std::is_array_v<T>)
+smart_ptr<T, Count> make_smart(Args&&... args) {
+    if constexpr (requires { requires Count::lazy_block; })
+        return smart_ptr<T, Count>(new T(std::forward<Args>(args)...));
+    else
+        return allocate_smart<T, Count>(std::allocator<std::remove_cv_t<T>>(), std::forward<Args>(args)...);
+}
+
+// make_smart() for objects that live until the process ends, such as
+// interned strings and static tables; see smart_ptr::freeze().
+template <typename T, typename Count = single_threaded, typename... Args>
+    requires (!std::is_array_v<T>)
+smart_ptr<T, Count> make_immortal(Args&&... args) {
+    auto p = make_smart<T, Count>(std::forward<Args>(args)...);
+    p.freeze();
+    return p;
+}
+
+// make_smart<T[]>(n) builds n value-initialized elements right after the
+// count, in one allocation; pass align (a power of two, e.g. 64 for
+// AVX-512 loads) to over-align the first element.
+template <typename T, typename Count = single_threaded>
+    requires std::is_unbounded_array_v<T>
+smart_ptr<T, Count> make_smart(std::size_t n, std::size_t align = alignof(std::remove_extent_t<T>)) {
+    return allocate_array<T, Count>(n, align, false);
+}
+
+// As make_smart<T[]>, but default-initializes the elements, which leaves
+// trivial types such as float uninitialized: no pass over a buffer that is
+// about to be overwritten.
+template <typename T, typename Count = single_threaded>
+    requires std::is_unbounded_array_v<T>
+smart_ptr<T, Count> make_smart_for_overwrite(std::size_t n, std::size_t align = alignof(std::remove_extent_t<T>)) {
+    return allocate_array<T, Count>(n, align, true);
+}
+
+// Casts that share ownership with p, like the std::shared_ptr ones. A
+// failed dynamic_pointer_cast returns an empty smart_ptr. Under
+// unique_first a cast of a sole owner allocates its block and may throw.
+template <typename T, typename U, typename Count, typename Check>
+smart_ptr<T, Count, Check> static_pointer_cast(const smart_ptr<U, Count, Check>& p)
+    noexcept(std::is_nothrow_constructible_v<smart_ptr<T, Count, Check>, const smart_ptr<U, Count, Check>&, T*>) {
+    return smart_ptr<T, Count, Check>(p, static_cast<T*>(p.try_get()));
+}
+
+template <typename T, typename U, typename Count, typename Check>
+smart_ptr<T, Count, Check> dynamic_pointer_cast(const smart_ptr<U, Count, Check>& p)
+    noexcept(std::is_nothrow_constructible_v<smart_ptr<T, Count, Check>, const smart_ptr<U, Count, Check>&, T*>) {
+    if (T* ptr = dynamic_cast<T*>(p.try_get())) return smart_ptr<T, Count, Check>(p, ptr);
+    return smart_ptr<T, Count, Check>();
+}
+
+template <typename T, typename U, typename Count, typename Check>
+smart_ptr<T, Count, Check> const_pointer_cast(const smart_ptr<U, Count, Check>& p)
+    noexcept(std::is_nothrow_constructible_v<smart_ptr<T, Count, Check>, const smart_ptr<U, Count, Check>&, T*>) {
+    return smart_ptr<T, Count, Check>(p, const_cast<T*>(p.try_get()));
+}
+
+// Non-owning companion of smart_ptr. It keeps the control block alive but
+// not the object; lock() hands out a smart_ptr with the same Check while
+// the object still exists. It can be made from a smart_ptr with any Check.
+template <typename T, typename Count = single_threaded, typename Check = throw_on_null>
+class weak_smart_ptr {
+    static_assert(!std::is_array_v<T>, "weak_smart_ptr does not support arrays");
+
+public:
+    weak_smart_ptr() noexcept :
+    ptr_(nullptr),
+    ref_(nullptr) {}
+
+    template <typename OtherCheck>
+    weak_smart_ptr(const smart_ptr<T, Count, OtherCheck>& sp) noexcept(noexcept(sp.share())) :
+    ptr_(sp.ptr_),
+    ref_(sp.share()) {
+        if (ref_) Count::increment_weak(*ref_);
+    }
+
+    weak_smart_ptr(const weak_smart_ptr& rhs) noexcept :
+    ptr_(rhs.ptr_),
+    ref_(rhs.ref_) {
+        if (ref_) Count::increment_weak(*ref_);
+    }
+
+    weak_smart_ptr(weak_smart_ptr&& rhs) noexcept :
+    ptr_(rhs.ptr_),
+    ref_(rhs.ref_) {
+        rhs.ptr_ = nullptr;
+        rhs.ref_ = nullptr;
+    }
+
+    weak_smart_ptr& operator=(const weak_smart_ptr& rhs) noexcept {
+        if (this != &rhs) {
+            release();
+            ptr_ = rhs.ptr_;
+            ref_ = rhs.ref_;
+            if (ref_) Count::increment_weak(*ref_);
+        }
+        return *this;
+    }
+
+    weak_smart_ptr& operator=(weak_smart_ptr&& rhs) noexcept {
+        if (this != &rhs) {
+            release();
+            ptr_ = rhs.ptr_;
+            ref_ = rhs.ref_;
+            rhs.ptr_ = nullptr;
+            rhs.ref_ = nullptr;
+        }
+        return *this;
+    }
+
+    template <typename OtherCheck>
+    weak_smart_ptr& operator=(const smart_ptr<T, Count, OtherCheck>& sp) noexcept(noexcept(sp.share())) {
+        return *this = weak_smart_ptr(sp);
+    }
+
+    bool expired() const noexcept {
+        return !ref_ || Count::load(*ref_) == 0;
+    }
+
+    int ref_count() const noexcept {
+        return ref_ ? Count::load(*ref_) : 0;
+    }
+
+    smart_ptr<T, Count, Check> lock() const noexcept {
+        if (ref_ && Count::try_increment(*ref_)) return smart_ptr<T, Count, Check>(ref_, ptr_);
+        return smart_ptr<T, Count, Check>();
+    }
+
+    ~weak_smart_ptr() {
+        release();
+    }
+
+private:
+    T* ptr_;                   // pointer to the referred object, possibly destroyed
+    ctrl_block<Count>* ref_;   // pointer to the block holding the reference counts
+
+    void release() noexcept {
+        if (ref_) ref_->release_weak();
+        ptr_ = nullptr;
+        ref_ = nullptr;
+    }
+};
+
+// Types whose objects can be moved to another address with memcpy() and
+// the source then forgotten, without running the move constructor or the
+// destructor. smart_vector relocates such elements with memmove(). The
+// pointer types qualify: a moved-from one only needs its fields cleared,
+// and nothing refers back to where a pointer lives.
+template <typename T>
+inline constexpr bool is_trivially_relocatable = std::is_trivially_copyable_v<T>;
+
+template <typename T, typename Count, typename Check>
+inline constexpr bool is_trivially_relocatable<smart_ptr<T, Count, Check>> = true;
+
+template <typename T, typename Count, typename Check>
+inline constexpr bool is_trivially_relocatable<weak_smart_ptr<T, Count, Check>> = true;
+
+#endif /* smart_ptr_h */
@@ -0,0 +1,126 @@
+#ifndef smart_ref_h
+#define smart_ref_h
+
+#include <cassert>
+#include <type_traits>
+#include "smart_ptr.h"
+
+// Non-owning view of the object an lvalue smart_ptr refers to, for
+// parameters: a function taking smart_ref<T> can be called with any
+// smart_ptr<T> or smart_ptr<Derived> without touching the count, where
+// passing smart_ptr<T> by value costs an increment and a decrement. The
+// caller's smart_ptr must outlive the call; to_owned() takes a real
+// reference for a callee that keeps the object.
+//
+// smart_ref<T, Count, Check, true> holds a weak reference instead, and in
+// debug builds asserts on use once the object is gone, which catches a
+// smart_ref kept beyond its owner. The weak reference is taken whether or
+// not NDEBUG is set, so such smart_refs can pass between translation units
+// built either way.
+template <typename T, typename Count = single_threaded, typename Check = throw_on_null, bool Watched = false>
+class smart_ref {
+    static_assert(!std::is_array_v<T>, "smart_ref does not support arrays");
+    static constexpr bool lazy = requires { requires Count::lazy_block; };
+
+public:
+    // Never allocates. Under unique_first a sole owner stays without a
+    // control block until to_owned() is called, which then reaches back to
+    // owner: it must not be moved or reassigned while the smart_ref is in
+    // use, and a watched smart_ref cannot check it for use after free.
+    template <typename U, typename OtherCheck>
+        requires std::is_convertible_v<U*, T*>
+    smart_ref(const smart_ptr<U, Count, OtherCheck>& owner) noexcept :
+    ptr_(owner.ptr_),
+    ref_(owner.is_unique() ? nullptr : owner.ref_) {
+        if constexpr (lazy) source_ = { &owner, &share_owner<U, OtherCheck> };
+        watch();
+    }
+
+    // A temporary would be gone before the smart_ref is used.
+    template <typename U, typename OtherCheck>
+    smart_ref(smart_ptr<U, Count, OtherCheck>&&) = delete;
+
+    smart_ref(const smart_ref& rhs) noexcept :
+    ptr_(rhs.ptr_),
+    ref_(rhs.ref_),
+    source_(rhs.source_) {
+        watch();
+    }
+
+    smart_ref& operator=(const smart_ref& rhs) noexcept {
+        if (this != &rhs) {
+            unwatch();
+            ptr_ = rhs.ptr_;
+            ref_ = rhs.ref_;
+            source_ = rhs.source_;
+            watch();
+        }
+        return *this;
+    }
+
+    ~smart_ref() {
+        unwatch();
+    }
+
+    T& operator*() const noexcept(noexcept(Check::check(ptr_))) {
+        Check::check(ptr_);
+        assert(alive() && "smart_ref used after its object was destroyed");
+        return *ptr_;
+    }
+
+    T* operator->() const noexcept(noexcept(Check::check(ptr_))) {
+        Check::check(ptr_);
+        assert(alive() && "smart_ref used after its object was destroyed");
+        return ptr_;
+    }
+
+    // The object, or nullptr if the smart_ptr was empty; never checks or throws.
+    T* try_get() const noexcept {
+        return ptr_;
+    }
+
+    // A smart_ptr sharing ownership with the one this was built from.
+    // Under unique_first this allocates the owner's control block if it
+    // has none yet, and may throw.
+    smart_ptr<T, Count, Check> to_owned() const noexcept(!lazy) {
+        assert(alive() && "smart_ref used after its object was destroyed");
+        ctrl_block<Count>* ref = ref_;
+        if constexpr (lazy) {
+            if (!ref && ptr_) ref = source_.share(source_.owner);
+        }
+        if (ref) Count::increment(*ref);
+        return smart_ptr<T, Count, Check>(ref, ptr_);
+    }
+
+private:
+    // The smart_ptr a unique_first smart_ref was built from, and how to
+    // give it a control block.
+    struct lazy_source {
+        const void* owner;
+        ctrl_block<Count>* (*share)(const void* owner);
+    };
+    struct no_source {};
+
+    T* ptr_;
+    ctrl_block<Count>* ref_;   // nullptr for a unique_first sole owner
+    [[no_unique_address]] std::conditional_t<lazy, lazy_source, no_source> source_ {};
+
+    template <typename U, typename OtherCheck>
+    static ctrl_block<Count>* share_owner(const void* owner) {
+        return static_cast<const smart_ptr<U, Count, OtherCheck>*>(owner)->share();
+    }
+
+    void watch() noexcept {
+        if (Watched && ref_) Count::increment_weak(*ref_);
+    }
+
+    void unwatch() noexcept {
+        if (Watched && ref_) ref_->release_weak();
+    }
+
+    bool alive() const noexcept {
+        return !Watched || !ref_ || Count::load(*ref_) != 0;
+    }
+};
+
+#endif /* smart_ref_h */
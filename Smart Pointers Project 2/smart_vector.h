@@ -0,0 +1,241 @@
+#ifndef smart_vector_h
+#define smart_vector_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "smart_ptr.h"
+
+// Vector that moves elements as raw bytes when they are trivially
+// relocatable, as smart_ptr and the other pointer types are: inserting and
+// erasing memmove() the tail, and growing is a realloc(), which for large
+// buffers can remap pages instead of copying them. Neither runs a move
+// constructor or a destructor per element. Other element types are moved
+// one by one, which requires a noexcept move constructor.
+template <typename T>
+class smart_vector {
+    static_assert(is_trivially_relocatable<T> || std::is_nothrow_move_constructible_v<T>,
+                  "smart_vector needs trivially relocatable or nothrow movable elements");
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    smart_vector() noexcept = default;
+
+    // Delegating to the default constructor makes the object complete
+    // before any element is copied, so if a copy throws the destructor
+    // frees the buffer and the elements built so far.
+    smart_vector(std::initializer_list<T> values) :
+    smart_vector() {
+        reserve(values.size());
+        for (const T& v : values) push_back(v);
+    }
+
+    smart_vector(const smart_vector& rhs) :
+    smart_vector() {
+        reserve(rhs.size());
+        for (const T& v : rhs) push_back(v);
+    }
+
+    smart_vector(smart_vector&& rhs) noexcept :
+    data_(std::exchange(rhs.data_, nullptr)),
+    size_(std::exchange(rhs.size_, 0)),
+    capacity_(std::exchange(rhs.capacity_, 0)) {}
+
+    smart_vector& operator=(const smart_vector& rhs) {
+        if (this != &rhs) {
+            smart_vector copy(rhs);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    smart_vector& operator=(smart_vector&& rhs) noexcept {
+        if (this != &rhs) {
+            smart_vector old(std::move(rhs));
+            swap(old);
+        }
+        return *this;
+    }
+
+    ~smart_vector() {
+        clear();
+        deallocate(data_, capacity_);
+    }
+
+    void swap(smart_vector& rhs) noexcept {
+        std::swap(data_, rhs.data_);
+        std::swap(size_, rhs.size_);
+        std::swap(capacity_, rhs.capacity_);
+    }
+
+    T* data() noexcept { return data_; }
+    const T* data() const noexcept { return data_; }
+    iterator begin() noexcept { return data_; }
+    iterator end() noexcept { return data_ + size_; }
+    const_iterator begin() const noexcept { return data_; }
+    const_iterator end() const noexcept { return data_ + size_; }
+    size_type size() const noexcept { return size_; }
+    size_type capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    T& operator[](size_type i) noexcept { return data_[i]; }
+    const T& operator[](size_type i) const noexcept { return data_[i]; }
+    T& back() noexcept { return data_[size_ - 1]; }
+    const T& back() const noexcept { return data_[size_ - 1]; }
+
+    void reserve(size_type n) {
+        if (n <= capacity_) return;
+        if constexpr (uses_realloc) {
+            data_ = reallocate(data_, n);
+        } else {
+            T* fresh = allocate(n);
+            relocate(data_, size_, fresh);
+            deallocate(data_, capacity_);
+            data_ = fresh;
+        }
+        capacity_ = n;
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    // args may refer into this vector: the new element is built before the
+    // old ones are relocated.
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (size_ == capacity_) return grow_and_emplace_back(std::forward<Args>(args)...);
+        ::new (static_cast<void*>(data_ + size_)) T(std::forward<Args>(args)...);
+        return data_[size_++];
+    }
+
+    void pop_back() noexcept {
+        std::destroy_at(data_ + --size_);
+    }
+
+    iterator insert(const_iterator pos, const T& value) {
+        return emplace(pos, value);
+    }
+
+    iterator insert(const_iterator pos, T&& value) {
+        return emplace(pos, std::move(value));
+    }
+
+    // Shifts the tail up by one and builds the element in the gap.
+    template <typename... Args>
+    iterator emplace(const_iterator pos, Args&&... args) {
+        size_type i = pos - data_;
+        T value(std::forward<Args>(args)...);
+        reserve(size_ < capacity_ ? capacity_ : grown());
+        relocate(data_ + i, size_ - i, data_ + i + 1);
+        ::new (static_cast<void*>(data_ + i)) T(std::move(value));
+        ++size_;
+        return data_ + i;
+    }
+
+    iterator erase(const_iterator pos) noexcept {
+        return erase(pos, pos + 1);
+    }
+
+    // Destroys [first, last) and shifts the tail down over the gap.
+    iterator erase(const_iterator first, const_iterator last) noexcept {
+        size_type i = first - data_;
+        size_type n = last - first;
+        std::destroy_n(data_ + i, n);
+        relocate(data_ + i + n, size_ - i - n, data_ + i);
+        size_ -= n;
+        return data_ + i;
+    }
+
+    void clear() noexcept {
+        std::destroy_n(data_, size_);
+        size_ = 0;
+    }
+
+private:
+    T* data_ = nullptr;
+    size_type size_ = 0;
+    size_type capacity_ = 0;
+
+    // Out of line so that emplace_back() stays small enough to inline.
+    template <typename... Args>
+    [[gnu::noinline]] T& grow_and_emplace_back(Args&&... args) {
+        size_type n = grown();
+        if constexpr (uses_realloc) {
+            T value(std::forward<Args>(args)...);
+            data_ = reallocate(data_, n);
+            ::new (static_cast<void*>(data_ + size_)) T(std::move(value));
+        } else {
+            T* fresh = allocate(n);
+            try {
+                ::new (static_cast<void*>(fresh + size_)) T(std::forward<Args>(args)...);
+            } catch (...) {
+                deallocate(fresh, n);
+                throw;
+            }
+            relocate(data_, size_, fresh);
+            deallocate(data_, capacity_);
+            data_ = fresh;
+        }
+        capacity_ = n;
+        return data_[size_++];
+    }
+
+    size_type grown() const {
+        if (capacity_ > SIZE_MAX / sizeof(T) / 2) throw std::length_error("smart_vector");
+        return std::max<size_type>(capacity_ * 2, 8);
+    }
+
+    // Trivially relocatable elements live in malloc() memory so that
+    // growing can use realloc().
+    static constexpr bool uses_realloc =
+        is_trivially_relocatable<T> && alignof(T) <= alignof(std::max_align_t);
+
+    static T* allocate(size_type n) {
+        if constexpr (uses_realloc) return reallocate(nullptr, n);
+        else return std::allocator<T>().allocate(n);
+    }
+
+    static T* reallocate(T* p, size_type n) {
+        if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+        void* fresh = std::realloc(static_cast<void*>(p), n * sizeof(T));
+        if (!fresh) throw std::bad_alloc();
+        return static_cast<T*>(fresh);
+    }
+
+    static void deallocate(T* p, size_type n) noexcept {
+        if constexpr (uses_realloc) std::free(p);
+        else if (p) std::allocator<T>().deallocate(p, n);
+    }
+
+    // Moves n elements from first to dest, which may overlap, leaving
+    // first's range as raw memory.
+    static void relocate(T* first, size_type n, T* dest) noexcept {
+        if (n == 0 || first == dest) return;
+        if constexpr (is_trivially_relocatable<T>) {
+            std::memmove(static_cast<void*>(dest), static_cast<const void*>(first), n * sizeof(T));
+        } else if (dest < first) {
+            for (size_type i = 0; i < n; ++i) {
+                ::new (static_cast<void*>(dest + i)) T(std::move(first[i]));
+                std::destroy_at(first + i);
+            }
+        } else {
+            for (size_type i = n; i-- > 0;) {
+                ::new (static_cast<void*>(dest + i)) T(std::move(first[i]));
+                std::destroy_at(first + i);
+            }
+        }
+    }
+};
+
+#endif /* smart_vector_h */